@@ -1,45 +1,167 @@
 #pragma once
-#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
-#define MAX_LEVEL (15)
-template <typename K, typename V>
-struct Node {
+#include "arena.h"
+#include "compare.h"
+#include "frozen_order_statistic.h"
+#include "interleave.h"
+#include "thread_pool.h"
+
+#define MAX_LEVEL (64)  // height of the head for 64-bit positions, narrower ones need fewer
+
+template <typename K, typename V, typename SizeT>
+struct Node;
+
+/**
+ * @brief Level and (next, span) tower of a skip list node, all the head sentinel is made of
+ *
+ * The tower is laid out right before the object itself, level 0 first, so a node costs one allocation and the bottom
+ * levels of a hop share a cache line with the key.
+ */
+template <typename K, typename V, typename SizeT>
+struct NodeLinks {
+    struct Link {
+        Node<K, V, SizeT> *next;
+        SizeT span;
+    };
+
+    int level;
+
+    explicit NodeLinks(int level) : level(level) {}
+
+    Link &link(int i) { return reinterpret_cast<Link *>(this)[-1 - i]; }
+    Link const &link(int i) const { return reinterpret_cast<Link const *>(this)[-1 - i]; }
+    Node<K, V, SizeT> *&next(int i) { return link(i).next; }
+    Node<K, V, SizeT> *next(int i) const { return link(i).next; }
+    SizeT &span(int i) { return link(i).span; }
+    SizeT span(int i) const { return link(i).span; }
+
+    /**
+     * @brief Head sentinel of `level` empty links, no key nor value is constructed
+     */
+    template <typename Alloc>
+    static NodeLinks *create(Alloc &alloc, int level) {
+        return construct<NodeLinks>(alloc, level);
+    }
+
+    template <typename Alloc>
+    static void destroy(Alloc &alloc, NodeLinks *head) {
+        deconstruct(alloc, head);
+    }
+
+  protected:
+    /**
+     * @brief Bytes in front of the node taken by a tower of `level` links, padded to keep any node aligned
+     */
+    static size_t tower_bytes(int level) {
+        size_t const bytes = sizeof(Link) * level;
+        return (bytes + alignof(Node<K, V, SizeT>) - 1) / alignof(Node<K, V, SizeT>) * alignof(Node<K, V, SizeT>);
+    }
+
+    /**
+     * @brief Number of `std::max_align_t` units a `T` of `level` takes, tower included
+     */
+    template <typename T>
+    static size_t block_units(int level) {
+        return (tower_bytes(level) + sizeof(T) + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+    }
+
+    /**
+     * @param alloc allocator of `std::max_align_t`, the block is carved in those units to keep the node aligned
+     * @param args forwarded to the constructor of `T` after `level`
+     */
+    template <typename T, typename Alloc, typename... Args>
+    static T *construct(Alloc &alloc, int level, Args &&...args) {
+        static_assert(
+            alignof(Node<K, V, SizeT>) <= alignof(std::max_align_t), "over-aligned keys/values not supported"
+        );
+        using traits      = std::allocator_traits<Alloc>;
+        size_t const size = block_units<T>(level);
+        char *const block = reinterpret_cast<char *>(traits::allocate(alloc, size));
+        T *node;
+        try {
+            node = new (block + tower_bytes(level)) T(level, std::forward<Args>(args)...);
+        } catch (...) {
+            traits::deallocate(alloc, reinterpret_cast<std::max_align_t *>(block), size);
+            throw;
+        }
+        for (int i = 0; i < level; i++)
+            node->link(i) = Link{nullptr, 0};
+        return node;
+    }
+
+    template <typename T, typename Alloc>
+    static void deconstruct(Alloc &alloc, T *node) {
+        int const level   = node->level;
+        char *const block = reinterpret_cast<char *>(node) - tower_bytes(level);
+        node->~T();
+        std::allocator_traits<Alloc>::deallocate(
+            alloc, reinterpret_cast<std::max_align_t *>(block), block_units<T>(level)
+        );
+    }
+};
+
+/**
+ * @brief Skip list node, the tower of `NodeLinks` followed by the pair
+ */
+template <typename K, typename V, typename SizeT>
+struct Node : NodeLinks<K, V, SizeT> {
     K first;
     V second;
-    Node **next;
-    int *span;
-    Node(const K &k, const V &v, int level) {
-        first  = k;
-        second = v;
-        next   = (Node<K, V> **)malloc(sizeof(Node<K, V> *) * level);
-        memset(next, 0, sizeof(Node<K, V> *) * level);
 
-        span = new int[level];
-        memset(span, 0, sizeof(int) * level);
+    /**
+     * @param args forwarded to the constructor of the value, none value-initializes it
+     */
+    template <typename KeyArg, typename... Args>
+    Node(int level, KeyArg &&k, Args &&...args)
+        : NodeLinks<K, V, SizeT>(level), first(std::forward<KeyArg>(k)), second(std::forward<Args>(args)...) {}
+
+    template <typename Alloc, typename KeyArg, typename... Args>
+    static Node *create(Alloc &alloc, int level, KeyArg &&k, Args &&...args) {
+        return NodeLinks<K, V, SizeT>::template construct<Node>(
+            alloc, level, std::forward<KeyArg>(k), std::forward<Args>(args)...
+        );
     }
-    ~Node() {
-        free(next);
-        delete[] span;
+
+    template <typename Alloc>
+    static void destroy(Alloc &alloc, Node *node) {
+        NodeLinks<K, V, SizeT>::deconstruct(alloc, node);
     }
 };
 
-template <typename K, typename V>
+/**
+ * @tparam SizeT type of sizes, spans and positions: `int` by default, `int64_t` past 2^31 elements, `uint32_t` for
+ * 4 bytes a link on lists up to 2^32 - 1 elements
+ */
+template <
+    typename K, typename V, typename Compare = std::less<K>, typename Allocator = std::allocator<std::pair<const K, V>>,
+    typename SizeT = int>
 class SkipList {
   public:
     class iterator {
       public:
-        iterator(Node<K, V> *ptr) : m_ptr(ptr) {}
+        iterator(Node<K, V, SizeT> *ptr) : m_ptr(ptr) {}
         bool operator==(const iterator &it) const { return m_ptr == it.m_ptr; }
         bool operator!=(const iterator &it) const { return m_ptr != it.m_ptr; }
-        Node<K, V> *operator->() const { return m_ptr; }
-        Node<K, V> *operator*() const { return m_ptr; }
+        Node<K, V, SizeT> *operator->() const { return m_ptr; }
+        Node<K, V, SizeT> *operator*() const { return m_ptr; }
         // 前缀自加
         iterator &operator++() {
-            if (m_ptr && m_ptr->next)
-                m_ptr = m_ptr->next[0];
+            if (m_ptr)
+                m_ptr = m_ptr->next(0);
             else
                 m_ptr = nullptr;
             return *this;
@@ -53,278 +175,1153 @@ class SkipList {
         }
 
       private:
-        Node<K, V> *m_ptr;
+        Node<K, V, SizeT> *m_ptr;
     };
 
-    SkipList(bool ascend = true);
+    using key_compare    = Compare;
+    using allocator_type = Allocator;
+    using size_type      = SizeT;
+
+    static_assert(std::is_integral_v<SizeT>, "sizes and positions must be integers");
+    // one level per bit of the largest size, the level limit never reaches more
+    static constexpr int HEAD_LEVEL = std::min(MAX_LEVEL, std::numeric_limits<SizeT>::digits + 1);
+
+    static constexpr size_t PARALLEL_GRAIN = 4096;  // bulk operations split their work down to chunks that large
+    static constexpr size_t BATCH_WIDTH    = 16;    // searches the batch lookups keep in flight at once
+    static constexpr std::uint64_t RANDOM_SEED = 0x9e3779b97f4a7c15;  // every list draws the same level sequence
+
+    explicit SkipList(const Compare &cmp = Compare(), const Allocator &alloc = Allocator());
+    explicit SkipList(const Allocator &alloc) : SkipList(Compare(), alloc) {}
+    /**
+     * @brief Runtime ascending/descending order, for comparators constructible from a direction, see
+     * `DirectionalSkipList`
+     */
+    template <typename C = Compare, std::enable_if_t<std::is_constructible_v<C, bool>, int> = 0>
+    SkipList(bool ascend, const Allocator &alloc = Allocator()) : SkipList(Compare(ascend), alloc) {}
     ~SkipList();
     void Init();
     void Depose();
+    void clear() {
+        Depose();
+        Init();
+    }
+    allocator_type get_allocator() const { return allocator_type(m_alloc); }
     bool insert(std::pair<const K, const V> const &p) { return insert(p.first, p.second); }
     bool insert(const K &key, const V &v);
+    bool insert(const K &key, V &&v) {
+        insert_or_assign(key, std::move(v));
+        return true;
+    }
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const K &key, Args &&...args);
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(K &&key, Args &&...args);
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(const K &key, M &&v);
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(K &&key, M &&v);
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args &&...args);
     iterator find(const K &key) const;
-    V &operator[](const K &key);
-    iterator findbypos(int pos) const;
+    iterator find_from(iterator from, const K &key) const;
+    V &operator[](const K &key) { return try_emplace_node(key).first->second; }
+    V &operator[](K &&key) { return try_emplace_node(std::move(key)).first->second; }
+    iterator findbypos(SizeT pos) const;
+    SizeT rank(const K &key) const;
+    iterator lower_bound(const K &key) const;
+    iterator upper_bound(const K &key) const;
+    SizeT count_range(const K &lo, const K &hi) const;
     bool erase(const K &key);
-    int get_random_level();
-    iterator begin() const { return iterator(m_head->next[0]); }
+    bool erase_at(SizeT pos);
+    SizeT erase_positions(SizeT first_pos, SizeT last_pos);
+    int get_random_level() { return random_level(level_limit(m_elem_count)); }
+    void set_promotion_probability(double p);
+    double promotion_probability() const { return 1.0 / (1 << m_level_shift); }
+    iterator begin() const { return iterator(m_head->next(0)); }
     iterator last() const { return iterator(m_last); }
     iterator end() const { return iterator(nullptr); }
-    int size() const { return m_elem_count; }
-    bool ascend_func(const K &k1, const K &k2) { return k1 < k2; }
-    bool descend_func(const K &k1, const K &k2) { return k1 > k2; }
+    SizeT size() const { return m_elem_count; }
+    key_compare key_comp() const { return m_cmp; }
     void display_list() {
 
         std::cout << "\n*****Skip List*****"
                   << "\n";
         for (int i = 0; i < m_curr_level; i++) {
-            Node<K, V> *node = this->m_head->next[i];
+            Node<K, V, SizeT> *node = this->m_head->next(i);
             std::cout << "Level " << i << ": ";
             while (node != NULL) {
-                std::cout << "(" << node->first << ":" << node->second << ";" << node->span[i] << ")  ";
-                node = node->next[i];
+                std::cout << "(" << node->first << ":" << node->second << ";" << node->span(i) << ")  ";
+                node = node->next(i);
             }
             std::cout << std::endl;
         }
     }
+    SkipList(const SkipList &sl);
+    SkipList(SkipList &&sl);
     SkipList &operator=(SkipList const &sl);
+    SkipList &operator=(SkipList &&sl);
+    template <typename ForwardIt>
+    void build_from_sorted(ForwardIt first, ForwardIt last, bool deterministic = true);
+    template <typename RandomIt>
+    void build_from_sorted(RandomIt first, RandomIt last, ThreadPool &pool);
+    std::vector<iterator> find_batch(std::vector<K> const &keys) const;
+    std::vector<iterator> findbypos_batch(std::vector<SizeT> const &positions) const;
+    std::vector<iterator> find_many(std::vector<K> const &keys, ThreadPool &pool = ThreadPool::instance()) const;
+    std::vector<iterator>
+    findbypos_many(std::vector<SizeT> const &positions, ThreadPool &pool = ThreadPool::instance()) const;
+    std::vector<std::pair<K, V>> to_vector(ThreadPool &pool = ThreadPool::instance()) const;
+    template <typename InputIt>
+    void insert_batch(InputIt first, InputIt last);
+    template <typename InputIt>
+    SizeT erase_batch(InputIt first, InputIt last);
+    /**
+     * @brief Immutable snapshot of the current content, for lookups by key and position on a list that rarely changes
+     */
+    FrozenOrderStatistic<K, V, Compare, Allocator> freeze() const { return {begin(), end(), m_cmp, get_allocator()}; }
 
   private:
-    std::function<bool(const K &k1, const K &k2)> m_func_cmp;
+    template <typename Before>
+    Node<K, V, SizeT> *partition(Before before, SizeT &rank) const;
+    void find_nodes(K const *keys, size_t count, iterator *found) const;
+    void findbypos_nodes(SizeT const *positions, size_t count, iterator *found) const;
+    Node<K, V, SizeT> *search(const K &key, NodeLinks<K, V, SizeT> **update, SizeT *ranks) const;
+    Node<K, V, SizeT> *finger_search(const K &key, NodeLinks<K, V, SizeT> **update, SizeT *ranks) const;
+    void save_finger(NodeLinks<K, V, SizeT> *const *update, SizeT const *ranks);
+    Node<K, V, SizeT> *resume_search(const K &key, NodeLinks<K, V, SizeT> **update, SizeT *ranks, SizeT *pending);
+    template <typename KeyArg, typename... Args>
+    Node<K, V, SizeT> *new_node(KeyArg &&key, Args &&...args);
+    Node<K, V, SizeT> *link_node(
+        NodeLinks<K, V, SizeT> **update, SizeT *ranks, Node<K, V, SizeT> *current, SizeT *pending = nullptr
+    );
+    template <typename KeyArg, typename... Args>
+    std::pair<Node<K, V, SizeT> *, bool> try_emplace_node(KeyArg &&key, Args &&...args);
+    void unlink(NodeLinks<K, V, SizeT> **update, Node<K, V, SizeT> *node, SizeT *pending = nullptr);
+    void settle(NodeLinks<K, V, SizeT> **update, SizeT *pending, int from, int to);
+    void erase_run(SizeT first, SizeT count);
+    void clone_links(SkipList const &sl);
+    void steal_links(SkipList &sl);
+    std::uint64_t next_random();
+    int random_level(int limit);
+    int level_limit(std::uint64_t count) const;
+    int perfect_level(SizeT pos) const {
+        return std::min(m_maxlevel, 1 + __builtin_ctzll(std::uint64_t(pos)) / m_level_shift);
+    }
+
+    using block_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<std::max_align_t>;
+
+    block_allocator m_alloc;
+    Compare m_cmp;
     int m_maxlevel;
     int m_curr_level;
-    int m_elem_count;
-    Node<K, V> *m_head;
-    Node<K, V> *m_last         = nullptr;
-    bool m_ascend              = true;
-    SkipList(const SkipList &) = delete;
+    SizeT m_elem_count;
+    int m_level_shift            = 1;  // a node climbs each level with probability 1 / 2^m_level_shift
+    std::uint64_t m_random_state = RANDOM_SEED;
+    NodeLinks<K, V, SizeT> *m_head;
+    Node<K, V, SizeT> *m_last = nullptr;
+    // search path of the last insert/erase, resumed by the next one when its key comes later
+    NodeLinks<K, V, SizeT> *m_finger[MAX_LEVEL];
+    SizeT m_finger_rank[MAX_LEVEL];
+    bool m_finger_valid = false;
 };
 
-template <typename K, typename V>
-SkipList<K, V>::SkipList(bool ascend) : m_ascend(ascend) {
-    m_maxlevel   = MAX_LEVEL;
+/**
+ * @brief `SkipList` ordered by a direction chosen at construction, `DirectionalSkipList<K, V> list(false)` descends
+ */
+template <typename K, typename V, typename Allocator = std::allocator<std::pair<const K, V>>, typename SizeT = int>
+using DirectionalSkipList = SkipList<K, V, directional_less<K>, Allocator, SizeT>;
+
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+SkipList<K, V, Compare, Allocator, SizeT>::SkipList(const Compare &cmp, const Allocator &alloc)
+    : m_alloc(alloc), m_cmp(cmp) {
+    m_maxlevel   = HEAD_LEVEL;
     m_curr_level = 0;
     m_elem_count = 0;
 
     Init();
 }
-template <typename K, typename V>
-void SkipList<K, V>::Init() {
-    K k;
-    V v;
-    m_head = new Node<K, V>(k, v, m_maxlevel);
-
-    if (m_ascend)
-        m_func_cmp = std::bind(&SkipList::ascend_func, this, std::placeholders::_1, std::placeholders::_2);
-    else
-        m_func_cmp = std::bind(&SkipList::descend_func, this, std::placeholders::_1, std::placeholders::_2);
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+void SkipList<K, V, Compare, Allocator, SizeT>::Init() {
+    m_head = NodeLinks<K, V, SizeT>::create(m_alloc, m_maxlevel);
 }
 
-template <typename K, typename V>
-SkipList<K, V>::~SkipList() {
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+SkipList<K, V, Compare, Allocator, SizeT>::~SkipList() {
     Depose();
 }
-template <typename K, typename V>
-void SkipList<K, V>::Depose() {
-    for (auto iter = begin(); iter != end();) {
-        auto next = iter;
-        iter++;
-        delete (*next);
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+void SkipList<K, V, Compare, Allocator, SizeT>::Depose() {
+    if (!can_abandon_nodes<K, V>(m_alloc)) {
+        for (auto iter = begin(); iter != end();) {
+            auto next = iter;
+            iter++;
+            Node<K, V, SizeT>::destroy(m_alloc, *next);
+        }
+        NodeLinks<K, V, SizeT>::destroy(m_alloc, m_head);
     }
-    delete m_head;
-    m_head       = nullptr;
+    m_head         = nullptr;
+    m_last         = nullptr;
+    m_finger_valid = false;
+    m_curr_level   = 0;
+    m_elem_count   = 0;
+}
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+SkipList<K, V, Compare, Allocator, SizeT>::SkipList(const SkipList &sl)
+    : m_alloc(std::allocator_traits<block_allocator>::select_on_container_copy_construction(sl.m_alloc)),
+      m_cmp(sl.m_cmp) {
+    m_maxlevel   = HEAD_LEVEL;
+    m_curr_level = 0;
+    m_elem_count = 0;
+
+    Init();
+    clone_links(sl);
+}
+/**
+ * @note the moved-from list is left empty
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+SkipList<K, V, Compare, Allocator, SizeT>::SkipList(SkipList &&sl) : m_alloc(sl.m_alloc), m_cmp(sl.m_cmp) {
+    m_maxlevel   = HEAD_LEVEL;
     m_curr_level = 0;
     m_elem_count = 0;
+
+    Init();
+    steal_links(sl);
 }
-template <typename K, typename V>
-SkipList<K, V> &SkipList<K, V>::operator=(SkipList const &sl) {
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+SkipList<K, V, Compare, Allocator, SizeT> &SkipList<K, V, Compare, Allocator, SizeT>::operator=(SkipList const &sl) {
     if (&sl == this)
         return *this;
-    Depose();
+    m_cmp = sl.m_cmp;
+    clear();
+    clone_links(sl);
+    return *this;
+}
+/**
+ * @note nodes are only taken over when the allocators can free each other's memory, they are copied otherwise
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+SkipList<K, V, Compare, Allocator, SizeT> &SkipList<K, V, Compare, Allocator, SizeT>::operator=(SkipList &&sl) {
+    if (&sl == this)
+        return *this;
+    if constexpr (std::allocator_traits<block_allocator>::propagate_on_container_move_assignment::value) {
+        if (m_alloc != sl.m_alloc) {
+            Depose();
+            m_alloc = sl.m_alloc;
+            Init();
+        }
+    } else if (m_alloc != sl.m_alloc) {
+        *this = sl;
+        sl.clear();
+        return *this;
+    }
+    m_cmp = sl.m_cmp;
+    clear();
+    steal_links(sl);
+    return *this;
+}
+/**
+ * @brief Exchange the nodes of this empty list with those of `sl`, the allocators must be interchangeable
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+void SkipList<K, V, Compare, Allocator, SizeT>::steal_links(SkipList &sl) {
+    std::swap(m_head, sl.m_head);
+    std::swap(m_last, sl.m_last);
+    std::swap(m_curr_level, sl.m_curr_level);
+    std::swap(m_elem_count, sl.m_elem_count);
+    m_level_shift     = sl.m_level_shift;
+    m_finger_valid    = false;
+    sl.m_finger_valid = false;
+}
+/**
+ * @brief Copy the nodes of `sl` with their levels, in one pass along the bottom level, into this empty list
+ *
+ * The copy has the same shape, so spans are taken over verbatim: no comparison, no level drawn, no rank computed.
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+void SkipList<K, V, Compare, Allocator, SizeT>::clone_links(SkipList const &sl) {
+    // the last node copied at each level
+    NodeLinks<K, V, SizeT> *tail[m_maxlevel];
+    for (int i = 0; i < m_maxlevel; i++) {
+        tail[i]         = m_head;
+        m_head->span(i) = sl.m_head->span(i);
+    }
 
-    m_ascend = sl.m_ascend;
-    Init();
-    // insert every elem
-    for (auto iter = sl.begin(); iter != sl.end(); ++iter)
-        insert(iter->first, iter->second);
+    for (Node<K, V, SizeT> *source = sl.m_head->next(0); source; source = source->next(0)) {
+        Node<K, V, SizeT> *const node =
+            Node<K, V, SizeT>::create(m_alloc, source->level, source->first, source->second);
+        for (int i = 0; i < source->level; i++) {
+            tail[i]->next(i) = node;
+            node->span(i)    = source->span(i);
+            tail[i]          = node;
+        }
+    }
+    m_curr_level  = sl.m_curr_level;
+    m_elem_count  = sl.m_elem_count;
+    m_level_shift = sl.m_level_shift;
+    m_last        = m_elem_count ? static_cast<Node<K, V, SizeT> *>(tail[0]) : nullptr;
+}
+/**
+ * @brief Replace the content with the pairs in [first, last) in a single left-to-right pass
+ *
+ * @note the range must be sorted by `key_comp()` and free of duplicate keys
+ * @param deterministic give the element of rank r a tower of `perfect_level(r)` levels (a perfect skip list),
+ * otherwise draw the heights from `get_random_level` as `insert` does
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+template <typename ForwardIt>
+void SkipList<K, V, Compare, Allocator, SizeT>::build_from_sorted(ForwardIt first, ForwardIt last, bool deterministic) {
+    clear();
 
-    return *this;
+    // the last node linked at each level and its position
+    NodeLinks<K, V, SizeT> *tail[m_maxlevel];
+    SizeT tail_pos[m_maxlevel];
+    for (int i = 0; i < m_maxlevel; i++) {
+        tail[i]     = m_head;
+        tail_pos[i] = 0;
+    }
+
+    // the list is still empty, random heights are capped for the size it is about to reach
+    std::uint64_t count = 0;
+    for (ForwardIt it = first; !deterministic && it != last; ++it)
+        count++;
+    int const limit = level_limit(count);
+    SizeT pos       = 0;
+    for (; first != last; ++first) {
+        pos++;
+        int const level = deterministic ? perfect_level(pos) : random_level(limit);
+
+        Node<K, V, SizeT> *const node = Node<K, V, SizeT>::create(m_alloc, level, first->first, first->second);
+        for (int i = 0; i < level; i++) {
+            tail[i]->next(i) = node;
+            tail[i]->span(i) = pos - tail_pos[i];
+            tail[i]          = node;
+            tail_pos[i]      = pos;
+        }
+        m_curr_level = std::max(m_curr_level, level);
+    }
+    m_last       = pos ? static_cast<Node<K, V, SizeT> *>(tail[0]) : nullptr;
+    m_elem_count = pos;
 }
-template <typename K, typename V>
-bool SkipList<K, V>::insert(const K &key, const V &v) {
-    // find the max elem that less than key
-    Node<K, V> *current = m_head;
-    Node<K, V> *update[m_maxlevel];
+/**
+ * @brief Same as the deterministic `build_from_sorted`, nodes allocated and linked by chunks in parallel on `pool`
+ *
+ * In a perfect skip list the node at position p reaches level i exactly when the stride 2^(i * m_level_shift) divides
+ * p, and its next node there is the one a stride further, so every tower can be linked knowing only its own position.
+ *
+ * @note the nodes are allocated from several threads, so this runs sequentially unless the allocator is stateless
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+template <typename RandomIt>
+void SkipList<K, V, Compare, Allocator, SizeT>::build_from_sorted(RandomIt first, RandomIt last, ThreadPool &pool) {
+    clear();
+    SizeT const count = last - first;
+    if (count == 0)
+        return;
 
-    int spans[m_maxlevel] = {0};
+    auto const run = [&](auto const &body) {
+        if (std::allocator_traits<block_allocator>::is_always_equal::value)
+            pool.parallel_for(0, count, PARALLEL_GRAIN, body);
+        else
+            body(0, count);
+    };
+    auto const stride = [this](int level) { return size_t(1) << (level * m_level_shift); };
+
+    std::vector<Node<K, V, SizeT> *> nodes(count);
+    run([&](size_t from, size_t to) {
+        for (size_t i = from; i < to; i++)
+            nodes[i] = Node<K, V, SizeT>::create(m_alloc, perfect_level(i + 1), first[i].first, first[i].second);
+    });
+    run([&](size_t from, size_t to) {
+        for (size_t i = from; i < to; i++) {
+            for (int level = 0; level < nodes[i]->level; level++) {
+                size_t const next = i + stride(level);
+                if (next < size_t(count)) {
+                    nodes[i]->next(level) = nodes[next];
+                    nodes[i]->span(level) = stride(level);
+                }
+            }
+        }
+    });
+    int const bits = std::numeric_limits<SizeT>::digits;  // no stride that wide fits a position
+    for (int level = 0; level < m_maxlevel && level * m_level_shift < bits && stride(level) <= size_t(count); level++) {
+        m_head->next(level) = nodes[stride(level) - 1];
+        m_head->span(level) = stride(level);
+        m_curr_level        = level + 1;
+    }
+    m_last       = nodes.back();
+    m_elem_count = count;
+}
+/**
+ * @brief `find` of every key, `BATCH_WIDTH` searches advanced in lock-step so their cache misses overlap
+ *
+ * @note pays off once the list outgrows the cache, a small batch or list is better served by `find`
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+std::vector<typename SkipList<K, V, Compare, Allocator, SizeT>::iterator>
+SkipList<K, V, Compare, Allocator, SizeT>::find_batch(std::vector<K> const &keys) const {
+    std::vector<iterator> found(keys.size(), end());
+    find_nodes(keys.data(), keys.size(), found.data());
+    return found;
+}
+/**
+ * @brief `findbypos` of every position, see `find_batch`
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+std::vector<typename SkipList<K, V, Compare, Allocator, SizeT>::iterator>
+SkipList<K, V, Compare, Allocator, SizeT>::findbypos_batch(std::vector<SizeT> const &positions) const {
+    std::vector<iterator> found(positions.size(), end());
+    findbypos_nodes(positions.data(), positions.size(), found.data());
+    return found;
+}
+/**
+ * @brief `find_batch` split into chunks resolved in parallel on `pool`
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+std::vector<typename SkipList<K, V, Compare, Allocator, SizeT>::iterator>
+SkipList<K, V, Compare, Allocator, SizeT>::find_many(std::vector<K> const &keys, ThreadPool &pool) const {
+    std::vector<iterator> found(keys.size(), end());
+    pool.parallel_for(0, keys.size(), PARALLEL_GRAIN, [&](size_t from, size_t to) {
+        find_nodes(keys.data() + from, to - from, found.data() + from);
+    });
+    return found;
+}
+/**
+ * @brief `findbypos_batch` split into chunks resolved in parallel on `pool`
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+std::vector<typename SkipList<K, V, Compare, Allocator, SizeT>::iterator>
+SkipList<K, V, Compare, Allocator, SizeT>::findbypos_many(std::vector<SizeT> const &positions, ThreadPool &pool) const {
+    std::vector<iterator> found(positions.size(), end());
+    pool.parallel_for(0, positions.size(), PARALLEL_GRAIN, [&](size_t from, size_t to) {
+        findbypos_nodes(positions.data() + from, to - from, found.data() + from);
+    });
+    return found;
+}
+/**
+ * @brief All pairs in key order, copied by chunks of positions in parallel on `pool`
+ *
+ * Each run of chunks starts from its first position, found through the spans, then walks the bottom level. The
+ * chunks are moved into the result in order afterwards.
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+std::vector<std::pair<K, V>> SkipList<K, V, Compare, Allocator, SizeT>::to_vector(ThreadPool &pool) const {
+    size_t const count = m_elem_count;
+    std::vector<std::vector<std::pair<K, V>>> chunks((count + PARALLEL_GRAIN - 1) / PARALLEL_GRAIN);
+    pool.parallel_for(0, chunks.size(), 1, [&](size_t first, size_t last) {
+        Node<K, V, SizeT> const *node = *findbypos(first * PARALLEL_GRAIN + 1);
+        for (size_t chunk = first; chunk < last; chunk++) {
+            size_t const length = std::min(PARALLEL_GRAIN, count - chunk * PARALLEL_GRAIN);
+            chunks[chunk].reserve(length);
+            for (size_t i = 0; i < length; i++, node = node->next(0))
+                chunks[chunk].emplace_back(node->first, node->second);
+        }
+    });
+    std::vector<std::pair<K, V>> pairs;
+    pairs.reserve(count);
+    for (auto &chunk : chunks)
+        pairs.insert(pairs.end(), std::make_move_iterator(chunk.begin()), std::make_move_iterator(chunk.end()));
+    return pairs;
+}
+/**
+ * @brief Walk down from the head to the last node before `key` at every level
+ *
+ * @param update filled with the predecessor of `key` at each level below `m_curr_level`
+ * @param ranks filled with the position of each `update[i]`, the head being 0
+ * @return the first node not before `key`, or nullptr
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+Node<K, V, SizeT> *
+SkipList<K, V, Compare, Allocator, SizeT>::search(const K &key, NodeLinks<K, V, SizeT> **update, SizeT *ranks) const {
+    NodeLinks<K, V, SizeT> *current = m_head;
+    SizeT rank                      = 0;
     for (int i = m_curr_level - 1; i >= 0; i--) {
-        int level_span = 0;
-        while (current->next[i] && m_func_cmp(current->next[i]->first, key)) {
-            level_span += current->span[i];
-            current = current->next[i];
+        while (current->next(i) && m_cmp(current->next(i)->first, key)) {
+            rank += current->span(i);
+            current = current->next(i);
         }
-        spans[i]  = level_span;
         update[i] = current;
+        ranks[i]  = rank;
     }
-    current = current->next[0];
-    if (current && current->first == key) {
-        current->second = v;
-        return true;
+    return current->next(0);
+}
+/**
+ * @brief Same as `search`, but start from the finger when `key` comes after it
+ *
+ * Climbs the finger only as high as the first level whose next node is not before `key`, then walks down from there,
+ * so the cost is O(log d) in the distance d from the previous update rather than O(log n).
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+Node<K, V, SizeT> *
+SkipList<K, V, Compare, Allocator, SizeT>::finger_search(
+    const K &key, NodeLinks<K, V, SizeT> **update, SizeT *ranks
+) const {
+    if (!m_finger_valid || (m_finger[0] != m_head && !m_cmp(static_cast<Node<K, V, SizeT> *>(m_finger[0])->first, key)))
+        return search(key, update, ranks);
+
+    int top = 0;
+    while (top + 1 < m_curr_level && m_finger[top]->next(top) && m_cmp(m_finger[top]->next(top)->first, key))
+        top++;
+    // above `top` the finger still precedes `key` directly
+    for (int i = top + 1; i < m_curr_level; i++) {
+        update[i] = m_finger[i];
+        ranks[i]  = m_finger_rank[i];
     }
 
-    if (!current || current->first != key) {
-        int random_level = get_random_level();
-        if (random_level > m_curr_level) {
-            for (int i = m_curr_level; i < random_level; i++)
-                update[i] = m_head;
-            m_curr_level = random_level;
+    NodeLinks<K, V, SizeT> *current = m_finger[top];
+    SizeT rank                      = m_finger_rank[top];
+    for (int i = top; i >= 0; i--) {
+        if (m_finger_rank[i] > rank) {
+            current = m_finger[i];
+            rank    = m_finger_rank[i];
         }
-        bool last = current == nullptr;
-        current   = new Node<K, V>(key, v, random_level);
-        if (last)
-            m_last = current;
-        int total_span = 0;
-        for (int i = 0; i < m_curr_level; ++i) {
-            if (i < random_level) {
-                total_span += (i > 0 ? spans[i - 1] : 1);
-
-                current->next[i]   = update[i]->next[i];
-                current->span[i]   = update[i]->next[i] ? (update[i]->span[i] - total_span + 1) : 0;
-                update[i]->next[i] = current;
-                update[i]->span[i] = total_span;
-            } else if (update[i]->next[i]) {
-                update[i]->span[i]++;
-            }
+        while (current->next(i) && m_cmp(current->next(i)->first, key)) {
+            rank += current->span(i);
+            current = current->next(i);
         }
-        m_elem_count++;
+        update[i] = current;
+        ranks[i]  = rank;
     }
-    return true;
+    return current->next(0);
 }
-template <typename K, typename V>
-V &SkipList<K, V>::operator[](const K &key) {
-    Node<K, V> *current = m_head;
-    Node<K, V> *update[m_maxlevel];
-
-    int spans[m_maxlevel] = {0};
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+void SkipList<K, V, Compare, Allocator, SizeT>::save_finger(NodeLinks<K, V, SizeT> *const *update, SizeT const *ranks) {
+    for (int i = 0; i < m_curr_level; i++) {
+        m_finger[i]      = update[i];
+        m_finger_rank[i] = ranks[i];
+    }
+    m_finger_valid = m_curr_level > 0;
+}
+/**
+ * @brief Same as `search`, but resume from the path left by a search for a smaller key
+ *
+ * A level is only walked from wherever the previous path is furthest, so neighbouring keys share most of the work.
+ *
+ * @param pending span adjustments owed to each `update[i]`, settled before its span is read or it leaves the path
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+Node<K, V, SizeT> *SkipList<K, V, Compare, Allocator, SizeT>::resume_search(
+    const K &key, NodeLinks<K, V, SizeT> **update, SizeT *ranks, SizeT *pending
+) {
+    NodeLinks<K, V, SizeT> *current = m_head;
+    SizeT rank                      = 0;
     for (int i = m_curr_level - 1; i >= 0; i--) {
-        int level_span = 0;
-        while (current->next[i] && m_func_cmp(current->next[i]->first, key)) {
-            level_span += current->span[i];
-            current = current->next[i];
+        if (ranks[i] > rank) {
+            current = update[i];
+            rank    = ranks[i];
         }
-        spans[i]  = level_span;
-        update[i] = current;
+        while (current->next(i) && m_cmp(current->next(i)->first, key)) {
+            if (current == update[i])
+                settle(update, pending, i, i + 1);
+            rank += current->span(i);
+            current = current->next(i);
+        }
+        if (current != update[i]) {
+            settle(update, pending, i, i + 1);
+            update[i] = current;
+            ranks[i]  = rank;
+        }
+    }
+    return current->next(0);
+}
+/**
+ * @brief Apply the deferred span adjustments of levels [from, to) of a batch path
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+void SkipList<K, V, Compare, Allocator, SizeT>::settle(
+    NodeLinks<K, V, SizeT> **update, SizeT *pending, int from, int to
+) {
+    for (int i = from; i < to; i++) {
+        if (pending[i] && update[i]->next(i))
+            update[i]->span(i) += pending[i];
+        pending[i] = 0;
     }
-    current = current->next[0];
-    if (current && current->first == key) {
-        return current->second;
+}
+/**
+ * @brief Allocate a node of random level, the pair built in place from `args`
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+template <typename KeyArg, typename... Args>
+Node<K, V, SizeT> *SkipList<K, V, Compare, Allocator, SizeT>::new_node(KeyArg &&key, Args &&...args) {
+    return Node<K, V, SizeT>::create(
+        m_alloc, get_random_level(), std::forward<KeyArg>(key), std::forward<Args>(args)...
+    );
+}
+/**
+ * @brief Link the new node `current` right after `update[0]`, then move the path onto it
+ *
+ * @param update the predecessor at each level, as left by `search`
+ * @param ranks the position of each `update[i]`
+ * @param pending if given, count the +1 owed by the levels above the new node there instead of applying it
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+Node<K, V, SizeT> *SkipList<K, V, Compare, Allocator, SizeT>::link_node(
+    NodeLinks<K, V, SizeT> **update, SizeT *ranks, Node<K, V, SizeT> *current, SizeT *pending
+) {
+    int const random_level = current->level;
+    if (random_level > m_curr_level) {
+        for (int i = m_curr_level; i < random_level; i++) {
+            update[i] = m_head;
+            ranks[i]  = 0;
+        }
+        m_curr_level = random_level;
     }
+    if (!update[0]->next(0))
+        m_last = current;
+    SizeT const rank = ranks[0] + 1;
+    for (int i = 0; i < m_curr_level; ++i) {
+        if (i < random_level) {
+            if (pending)
+                settle(update, pending, i, i + 1);
+            SizeT const total_span = rank - ranks[i];
 
-    if (!current || current->first != key) {
-        int random_level = get_random_level();
-        if (random_level > m_curr_level) {
-            for (int i = m_curr_level; i < random_level; i++)
-                update[i] = m_head;
-            m_curr_level = random_level;
+            current->next(i)   = update[i]->next(i);
+            current->span(i)   = update[i]->next(i) ? (update[i]->span(i) - total_span + 1) : 0;
+            update[i]->next(i) = current;
+            update[i]->span(i) = total_span;
+            update[i]          = current;
+            ranks[i]           = rank;
+        } else if (pending) {
+            pending[i]++;
+        } else if (update[i]->next(i)) {
+            update[i]->span(i)++;
         }
-        bool last = current == nullptr;
-        current   = new Node<K, V>(key, V(), random_level);
-        if (last)
-            m_last = current;
-        int total_span = 0;
-        for (int i = 0; i < m_curr_level; ++i) {
-            if (i < random_level) {
-                total_span += (i > 0 ? spans[i - 1] : 1);
-
-                current->next[i]   = update[i]->next[i];
-                current->span[i]   = update[i]->next[i] ? (update[i]->span[i] - total_span + 1) : 0;
-                update[i]->next[i] = current;
-                update[i]->span[i] = total_span;
-            } else if (update[i]->next[i]) {
-                update[i]->span[i]++;
-            }
+    }
+    m_elem_count++;
+    return current;
+}
+/**
+ * @brief Unlink and free `node`, whose predecessors at each level are in `update`
+ *
+ * @param pending if given, count the -1 owed by the levels above `node` there instead of applying it
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+void SkipList<K, V, Compare, Allocator, SizeT>::unlink(
+    NodeLinks<K, V, SizeT> **update, Node<K, V, SizeT> *node, SizeT *pending
+) {
+    // if remove the last elem
+    if (node == m_last) {
+        if (update[0] == m_head)
+            m_last = nullptr;  // then the list is empty
+        else
+            m_last = static_cast<Node<K, V, SizeT> *>(update[0]);
+    }
+
+    for (int i = 0; i < m_curr_level; ++i) {
+        if (update[i]->next(i) == node) {
+            if (pending)
+                settle(update, pending, i, i + 1);
+            update[i]->next(i) = node->next(i);
+            SizeT right_val    = node->next(i) ? node->span(i) : 0;
+            update[i]->span(i) = update[i]->span(i) + right_val - 1;
+        } else if (pending) {
+            pending[i]--;
+        } else if (update[i]->next(i)) {
+            update[i]->span(i)--;
         }
-        m_elem_count++;
     }
-    return current->second;
+    Node<K, V, SizeT>::destroy(m_alloc, node);
+    m_elem_count--;
+}
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+bool SkipList<K, V, Compare, Allocator, SizeT>::insert(const K &key, const V &v) {
+    insert_or_assign(key, v);
+    return true;
+}
+/**
+ * @brief Node holding `key`, built from `args` and linked if the key is absent
+ *
+ * @return the node, and whether it was inserted
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+template <typename KeyArg, typename... Args>
+std::pair<Node<K, V, SizeT> *, bool>
+SkipList<K, V, Compare, Allocator, SizeT>::try_emplace_node(KeyArg &&key, Args &&...args) {
+    NodeLinks<K, V, SizeT> *update[m_maxlevel];
+    SizeT ranks[m_maxlevel];
+
+    Node<K, V, SizeT> *current = finger_search(key, update, ranks);
+    bool const inserted = !current || m_cmp(key, current->first);
+    if (inserted)
+        current = link_node(update, ranks, new_node(std::forward<KeyArg>(key), std::forward<Args>(args)...));
+    save_finger(update, ranks);
+    return {current, inserted};
+}
+/**
+ * @brief Insert a value built in place from `args` if `key` is absent, leave the list untouched otherwise
+ *
+ * @return the element holding `key`, and whether it was inserted
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+template <typename... Args>
+std::pair<typename SkipList<K, V, Compare, Allocator, SizeT>::iterator, bool>
+SkipList<K, V, Compare, Allocator, SizeT>::try_emplace(const K &key, Args &&...args) {
+    auto const [node, inserted] = try_emplace_node(key, std::forward<Args>(args)...);
+    return {iterator(node), inserted};
+}
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+template <typename... Args>
+std::pair<typename SkipList<K, V, Compare, Allocator, SizeT>::iterator, bool>
+SkipList<K, V, Compare, Allocator, SizeT>::try_emplace(K &&key, Args &&...args) {
+    auto const [node, inserted] = try_emplace_node(std::move(key), std::forward<Args>(args)...);
+    return {iterator(node), inserted};
+}
+/**
+ * @brief Insert the pair, or assign `v` to the existing element, forwarding it either way
+ *
+ * @return the element holding `key`, and whether it was inserted
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+template <typename M>
+std::pair<typename SkipList<K, V, Compare, Allocator, SizeT>::iterator, bool>
+SkipList<K, V, Compare, Allocator, SizeT>::insert_or_assign(const K &key, M &&v) {
+    auto const [node, inserted] = try_emplace_node(key, std::forward<M>(v));
+    if (!inserted)
+        node->second = std::forward<M>(v);
+    return {iterator(node), inserted};
+}
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+template <typename M>
+std::pair<typename SkipList<K, V, Compare, Allocator, SizeT>::iterator, bool>
+SkipList<K, V, Compare, Allocator, SizeT>::insert_or_assign(K &&key, M &&v) {
+    auto const [node, inserted] = try_emplace_node(std::move(key), std::forward<M>(v));
+    if (!inserted)
+        node->second = std::forward<M>(v);
+    return {iterator(node), inserted};
+}
+/**
+ * @brief Build the pair right in a new node, keep it if its key is absent
+ *
+ * @param args a pair, or a key followed by the arguments of the value
+ * @return the element holding the key, and whether it was inserted
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+template <typename... Args>
+std::pair<typename SkipList<K, V, Compare, Allocator, SizeT>::iterator, bool>
+SkipList<K, V, Compare, Allocator, SizeT>::emplace(Args &&...args) {
+    Node<K, V, SizeT> *fresh;
+    if constexpr (sizeof...(Args) == 1)
+        fresh = [this](auto &&pair) {
+            return new_node(std::forward<decltype(pair)>(pair).first, std::forward<decltype(pair)>(pair).second);
+        }(std::forward<Args>(args)...);
+    else
+        fresh = new_node(std::forward<Args>(args)...);
+
+    NodeLinks<K, V, SizeT> *update[m_maxlevel];
+    SizeT ranks[m_maxlevel];
+
+    Node<K, V, SizeT> *const current = finger_search(fresh->first, update, ranks);
+    if (current && !m_cmp(fresh->first, current->first)) {
+        Node<K, V, SizeT>::destroy(m_alloc, fresh);
+        return {iterator(current), false};
+    }
+    link_node(update, ranks, fresh);
+    save_finger(update, ranks);
+    return {iterator(fresh), true};
 }
+/**
+ * @brief Insert or update every pair of [first, last) in one sweep
+ *
+ * The batch is sorted first, then each key resumes the search path of the previous one, and the span increments
+ * owed by the upper levels are applied once per path node rather than once per key.
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+template <typename InputIt>
+void SkipList<K, V, Compare, Allocator, SizeT>::insert_batch(InputIt first, InputIt last) {
+    std::vector<std::pair<K, V>> batch(first, last);
+    sort_unique_by_key(batch, m_cmp);
 
-template <typename K, typename V>
-typename SkipList<K, V>::iterator SkipList<K, V>::find(const K &key) const {
+    NodeLinks<K, V, SizeT> *update[m_maxlevel];
+    SizeT ranks[m_maxlevel];
+    SizeT pending[m_maxlevel];
+    m_finger_valid = false;
+    for (int i = 0; i < m_maxlevel; i++) {
+        update[i]  = m_head;
+        ranks[i]   = 0;
+        pending[i] = 0;
+    }
+
+    for (auto &[key, v] : batch) {
+        Node<K, V, SizeT> *const current = resume_search(key, update, ranks, pending);
+        if (current && !m_cmp(key, current->first))
+            current->second = std::move(v);
+        else
+            link_node(update, ranks, new_node(std::move(key), std::move(v)), pending);
+    }
+    settle(update, pending, 0, m_curr_level);
+}
+/**
+ * @brief Erase every key of [first, last) in one sweep, see `insert_batch`
+ *
+ * @return the number of elements erased
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+template <typename InputIt>
+SizeT SkipList<K, V, Compare, Allocator, SizeT>::erase_batch(InputIt first, InputIt last) {
+    std::vector<K> keys(first, last);
+    std::sort(keys.begin(), keys.end(), m_cmp);
+
+    NodeLinks<K, V, SizeT> *update[m_maxlevel];
+    SizeT ranks[m_maxlevel];
+    SizeT pending[m_maxlevel];
+    m_finger_valid = false;
+    for (int i = 0; i < m_maxlevel; i++) {
+        update[i]  = m_head;
+        ranks[i]   = 0;
+        pending[i] = 0;
+    }
+
+    SizeT const old_count = m_elem_count;
+    for (auto const &key : keys) {
+        Node<K, V, SizeT> *const current = resume_search(key, update, ranks, pending);
+        if (current && !m_cmp(key, current->first))
+            unlink(update, current, pending);
+    }
+    settle(update, pending, 0, m_curr_level);
+
+    while (m_curr_level && m_head->next(m_curr_level - 1) == nullptr)
+        m_curr_level--;
+    return old_count - m_elem_count;
+}
+
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+typename SkipList<K, V, Compare, Allocator, SizeT>::iterator
+SkipList<K, V, Compare, Allocator, SizeT>::find(const K &key) const {
     // find the max elem that less than key
-    Node<K, V> *current = m_head;
+    NodeLinks<K, V, SizeT> *current = m_head;
 
     for (int i = m_curr_level - 1; i >= 0; i--) {
-        while (current->next[i] && m_func_cmp(current->next[i]->first, key))
-            current = current->next[i];
+        while (current->next(i) && m_cmp(current->next(i)->first, key))
+            current = current->next(i);
+    }
+    Node<K, V, SizeT> *const found = current->next(0);
+    if (found && !m_cmp(key, found->first)) {
+        return iterator(found);
+    }
+    return end();
+}
+
+/**
+ * @brief Find `key` starting from an element before it, in O(log d) for a distance d between them
+ *
+ * Moves along the top of each tower met and only drops a level once the next tower would overshoot `key`.
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+typename SkipList<K, V, Compare, Allocator, SizeT>::iterator
+SkipList<K, V, Compare, Allocator, SizeT>::find_from(iterator from, const K &key) const {
+    if (from == end() || m_cmp(key, from->first))
+        return find(key);
+
+    Node<K, V, SizeT> *current = *from;
+    int i               = current->level - 1;
+    while (current->next(i) && m_cmp(current->next(i)->first, key)) {
+        current = current->next(i);
+        i       = current->level - 1;
+    }
+    for (; i >= 0; i--) {
+        while (current->next(i) && m_cmp(current->next(i)->first, key))
+            current = current->next(i);
     }
-    current = current->next[0];
-    if (current && current->first == key) {
+    if (!m_cmp(current->first, key))
+        return iterator(current);
+    current = current->next(0);
+    if (current && !m_cmp(key, current->first)) {
         return iterator(current);
     }
     return end();
 }
 
-template <typename K, typename V>
-typename SkipList<K, V>::iterator SkipList<K, V>::findbypos(int pos) const {
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+typename SkipList<K, V, Compare, Allocator, SizeT>::iterator
+SkipList<K, V, Compare, Allocator, SizeT>::findbypos(SizeT pos) const {
     // find the max elem that less than key
-    Node<K, V> *current = m_head;
+    NodeLinks<K, V, SizeT> *current = m_head;
     if (pos > 1) {
-        int total = 0;
+        SizeT total = 0;
         for (int i = m_curr_level - 1; i >= 0; i--) {
-            while (current->next[i] && current->span[i] + total < pos) {
-                total += current->span[i];
-                current = current->next[i];
+            while (current->next(i) && current->span(i) + total < pos) {
+                total += current->span(i);
+                current = current->next(i);
             }
         }
     }
-    return iterator(current->next[0]);
+    return iterator(current->next(0));
 }
-template <typename K, typename V>
-bool SkipList<K, V>::erase(const K &key) {
-    // find the current elem
-    Node<K, V> *current = m_head;
-    Node<K, V> *update[m_maxlevel];
-
+/**
+ * @brief First node for which `before(node key)` is false, `before` being true on a prefix of the key order
+ *
+ * @param rank set to the number of nodes before the one returned, summed from the spans crossed on the way down
+ * @return the node, or nullptr when `before` holds for every key
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+template <typename Before>
+Node<K, V, SizeT> *SkipList<K, V, Compare, Allocator, SizeT>::partition(Before before, SizeT &rank) const {
+    NodeLinks<K, V, SizeT> *current = m_head;
+    rank                     = 0;
     for (int i = m_curr_level - 1; i >= 0; i--) {
-        while (current->next[i] && m_func_cmp(current->next[i]->first, key))
-            current = current->next[i];
-        update[i] = current;
+        while (current->next(i) && before(current->next(i)->first)) {
+            rank += current->span(i);
+            current = current->next(i);
+        }
     }
-    current = current->next[0];
-    if (!current || current->first != key) {
+    return current->next(0);
+}
+/**
+ * @brief `find` of `count` keys into `found`, the searches interleaved to overlap their cache misses
+ *
+ * Each hop prefetches the key and the link at the current level of the next node to be compared, the two reads the
+ * following hop makes.
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+void SkipList<K, V, Compare, Allocator, SizeT>::find_nodes(K const *keys, size_t count, iterator *found) const {
+    struct Lane {
+        NodeLinks<K, V, SizeT> *current;  // last node before the key met so far
+        int level;
+    };
+    auto const prefetch = [](Lane const &lane) {
+        if (Node<K, V, SizeT> const *const ahead = lane.current->next(lane.level)) {
+            __builtin_prefetch(&ahead->first);
+            __builtin_prefetch(&ahead->link(lane.level));
+        }
+    };
+    auto const start = [&](size_t, Lane &lane) {
+        lane = Lane{m_head, m_curr_level - 1};
+        if (lane.level < 0)
+            return false;
+        prefetch(lane);
+        return true;
+    };
+    auto const step = [&](size_t i, Lane &lane) {
+        Node<K, V, SizeT> *const next = lane.current->next(lane.level);
+        if (next && m_cmp(next->first, keys[i])) {
+            lane.current = next;
+        } else if (lane.level-- == 0) {
+            if (next && !m_cmp(keys[i], next->first))
+                found[i] = iterator(next);
+            return false;
+        }
+        prefetch(lane);
+        return true;
+    };
+    interleave_searches<BATCH_WIDTH, Lane>(count, start, step);
+}
+/**
+ * @brief `findbypos` of `count` positions into `found`, see `find_nodes`
+ *
+ * Only the spans are compared, so a hop prefetches no key, just the link of the next node at the current level.
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+void SkipList<K, V, Compare, Allocator, SizeT>::findbypos_nodes(
+    SizeT const *positions, size_t count, iterator *found
+) const {
+    struct Lane {
+        NodeLinks<K, V, SizeT> *current;
+        int level;
+        SizeT total;  // position of `current`, the head being 0
+    };
+    auto const prefetch = [](Lane const &lane) {
+        if (Node<K, V, SizeT> const *const ahead = lane.current->next(lane.level))
+            __builtin_prefetch(&ahead->link(lane.level));
+    };
+    auto const start = [&](size_t i, Lane &lane) {
+        found[i] = iterator(m_head->next(0));
+        lane     = Lane{m_head, m_curr_level - 1, 0};
+        if (positions[i] <= 1 || lane.level < 0)
+            return false;
+        prefetch(lane);
+        return true;
+    };
+    auto const step = [&](size_t i, Lane &lane) {
+        Node<K, V, SizeT> *const next = lane.current->next(lane.level);
+        if (next && lane.current->span(lane.level) + lane.total < positions[i]) {
+            lane.total += lane.current->span(lane.level);
+            lane.current = next;
+        } else if (lane.level-- == 0) {
+            found[i] = iterator(lane.current->next(0));
+            return false;
+        }
+        prefetch(lane);
+        return true;
+    };
+    interleave_searches<BATCH_WIDTH, Lane>(count, start, step);
+}
+/**
+ * @brief Number of keys before `key`, whether `key` is present or not
+ *
+ * @note a present key is found at `findbypos(rank(key) + 1)`
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+SizeT SkipList<K, V, Compare, Allocator, SizeT>::rank(const K &key) const {
+    SizeT rank = 0;
+    partition([this, &key](const K &other) { return m_cmp(other, key); }, rank);
+    return rank;
+}
+/**
+ * @brief First element whose key is not before `key`
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+typename SkipList<K, V, Compare, Allocator, SizeT>::iterator
+SkipList<K, V, Compare, Allocator, SizeT>::lower_bound(const K &key) const {
+    SizeT rank = 0;
+    return iterator(partition([this, &key](const K &other) { return m_cmp(other, key); }, rank));
+}
+/**
+ * @brief First element whose key is after `key`
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+typename SkipList<K, V, Compare, Allocator, SizeT>::iterator
+SkipList<K, V, Compare, Allocator, SizeT>::upper_bound(const K &key) const {
+    SizeT rank = 0;
+    return iterator(partition([this, &key](const K &other) { return !m_cmp(key, other); }, rank));
+}
+/**
+ * @brief Number of keys in [lo, hi), two descents whatever the count
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+SizeT SkipList<K, V, Compare, Allocator, SizeT>::count_range(const K &lo, const K &hi) const {
+    if (!m_cmp(lo, hi))
+        return 0;
+    return rank(hi) - rank(lo);
+}
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+bool SkipList<K, V, Compare, Allocator, SizeT>::erase(const K &key) {
+    NodeLinks<K, V, SizeT> *update[m_maxlevel];
+    SizeT ranks[m_maxlevel];
+
+    Node<K, V, SizeT> *const current = finger_search(key, update, ranks);
+    if (!current || m_cmp(key, current->first)) {
         return false;
     }
-    // if remove the last elem
-    if (current == m_last) {
-        if (update[0] == m_head)
-            m_last = nullptr;  // then the list is empty
-        else
-            m_last = update[0];
+    unlink(update, current);
+    // if remove the highest level then change the curr_level
+    while (m_curr_level && m_head->next(m_curr_level - 1) == nullptr)
+        m_curr_level--;
+    save_finger(update, ranks);
+    return true;
+}
+
+/**
+ * @brief Erase the element at `pos`, with a single descent
+ *
+ * @return whether `pos` was in range
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+bool SkipList<K, V, Compare, Allocator, SizeT>::erase_at(SizeT pos) {
+    if (pos < 1 || pos > m_elem_count)
+        return false;
+    erase_run(pos, 1);
+    return true;
+}
+/**
+ * @brief Erase the elements at positions [first_pos, last_pos), clipped to the list, in O(log n + k) for k erased
+ * elements, see `erase_run`
+ *
+ * @return the number of elements erased
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+SizeT SkipList<K, V, Compare, Allocator, SizeT>::erase_positions(SizeT first_pos, SizeT last_pos) {
+    SizeT const first = std::max<SizeT>(first_pos, 1);
+    if (first > m_elem_count || last_pos <= first)
+        return 0;
+    // bounds are compared one below `last_pos`, nothing is computed past the largest size
+    SizeT const last  = last_pos - 1 <= m_elem_count ? last_pos - 1 : m_elem_count;
+    SizeT const count = last - first + 1;
+    erase_run(first, count);
+    return count;
+}
+/**
+ * @brief Erase the `count` elements from position `first` on, all of them in the list
+ *
+ * One descent finds the predecessors of the run, then a single walk along the run frees it and picks up, at each
+ * level, the link out of the last tower reaching that level.
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+void SkipList<K, V, Compare, Allocator, SizeT>::erase_run(SizeT first, SizeT count) {
+    NodeLinks<K, V, SizeT> *update[m_maxlevel];
+    SizeT ranks[m_maxlevel];
+    NodeLinks<K, V, SizeT> *current = m_head;
+    SizeT rank                      = 0;
+    for (int i = m_curr_level - 1; i >= 0; i--) {
+        while (current->next(i) && rank + current->span(i) < first) {
+            rank += current->span(i);
+            current = current->next(i);
+        }
+        update[i] = current;
+        ranks[i]  = rank;
     }
-    // if find then remove it
 
-    for (int i = 0; i < m_curr_level; ++i) {
-        if (update[i]->next[i] == current) {
-            update[i]->next[i] = current->next[i];
-            int right_val      = current->next[i] ? current->span[i] : 0;
-            update[i]->span[i] = update[i]->span[i] + right_val - 1;
-        } else if (update[i]->next[i]) {
-            update[i]->span[i]--;
+    // the first node past the run at each level and its position, taken from the last tower of the run reaching it
+    Node<K, V, SizeT> *past[m_maxlevel];
+    SizeT past_rank[m_maxlevel];
+    for (int i = 0; i < m_curr_level; i++) {
+        past[i]      = update[i]->next(i);
+        past_rank[i] = ranks[i] + update[i]->span(i);
+    }
+    Node<K, V, SizeT> *doomed = update[0]->next(0);
+    for (SizeT erased = 0; erased < count; erased++) {
+        SizeT const pos = first + erased;
+        for (int i = 0; i < doomed->level; i++) {
+            past[i]      = doomed->next(i);
+            past_rank[i] = pos + doomed->span(i);
         }
+        Node<K, V, SizeT> *const next = doomed->next(0);
+        Node<K, V, SizeT>::destroy(m_alloc, doomed);
+        doomed = next;
     }
-    // if remove the highest level then change the curr_level
-    while (m_curr_level && m_head->next[m_curr_level - 1] == nullptr)
+
+    for (int i = 0; i < m_curr_level; i++) {
+        update[i]->next(i) = past[i];
+        update[i]->span(i) = past[i] ? past_rank[i] - ranks[i] - count : 0;
+    }
+    if (count > m_elem_count - first)
+        m_last = update[0] == m_head ? nullptr : static_cast<Node<K, V, SizeT> *>(update[0]);
+    m_elem_count -= count;
+    while (m_curr_level && m_head->next(m_curr_level - 1) == nullptr)
         m_curr_level--;
-    delete current;
-    m_elem_count--;
-    return true;
+    save_finger(update, ranks);
 }
 
-template <typename K, typename V>
-int SkipList<K, V>::get_random_level() {
-    int k = 1;
-    while (rand() % 2)
-        k++;
-    return std::min(m_maxlevel, k);
+/**
+ * @brief Geometric level from the trailing zeros of a single random word, every level up takes `m_level_shift` more
+ *
+ * @param limit highest level to return, see `level_limit`
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+int SkipList<K, V, Compare, Allocator, SizeT>::random_level(int limit) {
+    int const level = 1 + __builtin_ctzll(next_random() | std::uint64_t(1) << 63) / m_level_shift;
+    return std::min(level, limit);
+}
+/**
+ * @brief Probability for a node to reach the next level up, 1/2 by default, rounded to a power of 1/2
+ *
+ * A lower probability trades a few more hops per level for fewer links, 1/4 halves them.
+ *
+ * @note the nodes already linked keep their levels
+ * @throw std::invalid_argument unless 0 < p < 1
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+void SkipList<K, V, Compare, Allocator, SizeT>::set_promotion_probability(double p) {
+    if (!(p > 0 && p < 1))
+        throw std::invalid_argument("the promotion probability must lie strictly between 0 and 1");
+    m_level_shift = std::clamp(int(std::lround(-std::log2(p))), 1, 16);
+}
+/**
+ * @brief Next word of the list's own splitmix64 generator
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+std::uint64_t SkipList<K, V, Compare, Allocator, SizeT>::next_random() {
+    std::uint64_t z = m_random_state += 0x9e3779b97f4a7c15;
+    z               = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z               = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+/**
+ * @brief Highest level worth drawing on a list of `count` nodes, one past the first level expected to hold a single
+ * node
+ *
+ * It grows with the list, so a small list never pays for a tall tower and a large one is never capped short.
+ */
+template <typename K, typename V, typename Compare, typename Allocator, typename SizeT>
+int SkipList<K, V, Compare, Allocator, SizeT>::level_limit(std::uint64_t count) const {
+    int const bits = 64 - __builtin_clzll(count + 1);
+    return std::min(m_maxlevel, 2 + bits / m_level_shift);
 }
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <type_traits>
+
+/**
+ * @brief Monotonic memory resource with per-size free lists
+ *
+ * Memory is carved out of large chunks and only handed back upstream by `release()` or the destructor. Deallocated
+ * blocks are kept on a free list per size class and reused by the next allocation of that size.
+ *
+ * Containers backed by an `Arena` (through `std::pmr::polymorphic_allocator`) drop their nodes in O(1) when keys and
+ * values are trivially destructible: nothing is walked or freed, the memory comes back when the arena is released.
+ */
+class Arena : public std::pmr::memory_resource {
+  public:
+    static constexpr size_t GRANULE    = alignof(std::max_align_t);
+    static constexpr size_t SIZE_CLASS = 64;  // blocks up to SIZE_CLASS * GRANULE bytes are recycled
+
+    explicit Arena(
+        size_t chunk_size = 64 * 1024, std::pmr::memory_resource *upstream = std::pmr::get_default_resource()
+    )
+        : m_chunk_size(chunk_size), m_upstream(upstream) {}
+    Arena(Arena const &)            = delete;
+    Arena &operator=(Arena const &) = delete;
+    ~Arena() override { release(); }
+
+    /**
+     * @brief Give every chunk back upstream, invalidating all memory handed out so far
+     */
+    void release() {
+        while (m_chunks) {
+            Chunk *const prev = m_chunks->prev;
+            m_upstream->deallocate(m_chunks, m_chunks->bytes, alignof(Chunk));
+            m_chunks = prev;
+        }
+        m_cursor = m_end = nullptr;
+        m_free.fill(nullptr);
+    }
+
+  protected:
+    void *do_allocate(size_t bytes, size_t align) override {
+        bytes = round_up(std::max<size_t>(bytes, 1), GRANULE);
+        if (size_t const cls = bytes / GRANULE; align <= GRANULE && cls < SIZE_CLASS && m_free[cls]) {
+            FreeBlock *const block = m_free[cls];
+            m_free[cls]            = block->next;
+            return block;
+        }
+
+        auto cursor = reinterpret_cast<uintptr_t>(m_cursor);
+        auto start  = round_up(cursor, std::max(align, GRANULE));
+        if (!m_cursor || start + bytes > reinterpret_cast<uintptr_t>(m_end)) {
+            grow(bytes + align);
+            cursor = reinterpret_cast<uintptr_t>(m_cursor);
+            start  = round_up(cursor, std::max(align, GRANULE));
+        }
+        m_cursor = reinterpret_cast<char *>(start + bytes);
+        return reinterpret_cast<void *>(start);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t align) override {
+        bytes = round_up(std::max<size_t>(bytes, 1), GRANULE);
+        if (size_t const cls = bytes / GRANULE; align <= GRANULE && cls < SIZE_CLASS) {
+            auto *const block = static_cast<FreeBlock *>(p);
+            block->next       = m_free[cls];
+            m_free[cls]       = block;
+        }
+        // larger blocks stay in their chunk until `release()`
+    }
+
+    bool do_is_equal(std::pmr::memory_resource const &other) const noexcept override { return this == &other; }
+
+  private:
+    struct alignas(std::max_align_t) Chunk {
+        Chunk *prev;
+        size_t bytes;
+    };
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    static size_t round_up(size_t n, size_t align) { return (n + align - 1) / align * align; }
+
+    void grow(size_t at_least) {
+        size_t const bytes = sizeof(Chunk) + std::max(m_chunk_size, at_least);
+        auto *const chunk  = static_cast<Chunk *>(m_upstream->allocate(bytes, alignof(Chunk)));
+        chunk->prev        = m_chunks;
+        chunk->bytes       = bytes;
+        m_chunks           = chunk;
+        m_cursor           = reinterpret_cast<char *>(chunk + 1);
+        m_end              = reinterpret_cast<char *>(chunk) + bytes;
+    }
+
+    size_t m_chunk_size;
+    std::pmr::memory_resource *m_upstream;
+    Chunk *m_chunks = nullptr;
+    char *m_cursor  = nullptr;
+    char *m_end     = nullptr;
+    std::array<FreeBlock *, SIZE_CLASS> m_free{};
+};
+
+/**
+ * @brief Whether nodes obtained from `alloc` may be abandoned instead of being freed one by one
+ */
+template <typename Alloc>
+bool is_arena_backed(Alloc const &) {
+    return false;
+}
+template <typename T>
+bool is_arena_backed(std::pmr::polymorphic_allocator<T> const &alloc) {
+    return dynamic_cast<Arena *>(alloc.resource()) != nullptr;
+}
+
+/**
+ * @brief Whether a container of `K` to `V` may drop its nodes from `alloc` without visiting them
+ *
+ * Nodes living in an arena are reclaimed with it, so when nothing needs destroying there is no need to chase them one
+ * by one on `clear()` or destruction.
+ */
+template <typename K, typename V, typename Alloc>
+bool can_abandon_nodes(Alloc const &alloc) {
+    return std::is_trivially_destructible_v<K> && std::is_trivially_destructible_v<V> && is_arena_backed(alloc);
+}
@@ -1,47 +1,85 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <iterator>
+#include <limits>
+#include <memory>
 #include <queue>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
 #include <utility>
-
-template <typename K, typename V>
+#include <vector>
+
+#include "arena.h"
+#include "balance_policy.h"
+#include "compare.h"
+#include "frozen_order_statistic.h"
+#include "interleave.h"
+#include "thread_pool.h"
+
+/**
+ * @tparam SizeT type of sizes and positions: `size_t` by default, `uint32_t` halves the bookkeeping of a node on trees
+ * up to 2^32 - 1 elements
+ * @tparam Balance how the tree keeps its shape, see `balance_policy.h`: `AvlBalance` by default, `WeightBalance`
+ * balances on the sizes alone and drops the height, `RedBlackBalance` rotates less on updates
+ */
+template <
+    typename K, typename V, typename Compare = std::less<K>, typename Allocator = std::allocator<std::pair<const K, V>>,
+    typename SizeT = size_t, typename Balance = AvlBalance>
 class AvlOrderStatisticTree {
   public:
-    static constexpr int BASE_INDEX = 1;  // the base index of `findbypos`
+    static constexpr int BASE_INDEX = 1;                    // the base index of `findbypos`
+    static constexpr int MAX_HEIGHT = Balance::MAX_HEIGHT;  // longest path the balancing policy allows
+    static constexpr size_t PARALLEL_GRAIN = 4096;  // set operations fork only on subtrees at least that large
+    static constexpr size_t BATCH_WIDTH    = 16;    // descents the batch lookups keep in flight at once
 
   public:
     // Define for some STL usage
     using key_type        = K;
     using value_type      = V;
     using pair_type       = std::pair<key_type, value_type>;
-    using size_type       = size_t;
-    using balance_type    = ptrdiff_t;
+    using size_type       = SizeT;
+    using balance_type    = ptrdiff_t;  // signed difference of subtree heights
+    using balance_policy  = Balance;
     using pointer         = value_type *;
     using const_pointer   = const value_type *;
     using reference       = value_type &;
     using const_reference = const value_type &;
+    using key_compare     = Compare;
+    using allocator_type  = Allocator;
+
+    static_assert(std::is_integral_v<SizeT>, "sizes and positions must be integers");
 
   private:
-    class Node {
+    using tag_type = typename Balance::Tag;
+
+    class Node : public tag_type {
       public:
         // key_type key;
         // value_type value;
         pair_type data;
-        size_type height, size;
+        size_type size;
         Node *left, *right, *parent;
 
       public:
-        Node(key_type k, value_type v)
-            : data(std::make_pair(k, v)), height(1), size(1), left(nullptr), right(nullptr), parent(nullptr) {}
+        /**
+         * @param args forwarded to the constructor of the pair, piecewise ones included
+         */
+        template <typename... Args>
+        explicit Node(Args &&...args)
+            : data(std::forward<Args>(args)...), size(1), left(nullptr), right(nullptr), parent(nullptr) {}
         ~Node() {}
 
         Node &operator=(Node const &other) {
             if (this == &other)
                 return *this;
 
+            tag_type::operator=(other);
             this->data   = std::make_pair(other.data.first, other.data.second);
-            this->height = other.height;
             this->size   = other.size;
             this->left   = other.left;
             this->right  = other.right;
@@ -95,7 +133,7 @@ class AvlOrderStatisticTree {
       public:
         using iterator_category = std::bidirectional_iterator_tag;
         using value_type        = pair_type;
-        using size_type         = size_t;
+        using size_type         = SizeT;
         using difference_type   = ptrdiff_t;
         using pointer           = value_type *;
         using const_pointer     = const value_type *;
@@ -149,7 +187,7 @@ class AvlOrderStatisticTree {
       public:
         using iterator_category = std::bidirectional_iterator_tag;
         using value_type        = pair_type;
-        using size_type         = size_t;
+        using size_type         = SizeT;
         using difference_type   = ptrdiff_t;
         using pointer           = const value_type *;
         using const_pointer     = const value_type *;
@@ -199,225 +237,642 @@ class AvlOrderStatisticTree {
     };
 
   private:
+    using node_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+    using node_traits    = std::allocator_traits<node_allocator>;
+
     Node *root = nullptr;
-    // [[deprecated("low performance, use function pointer instead")]] std::function<bool(key_type, key_type)> cmp_func
-    // = std::less<key_type>();
-    bool (*cmp)(key_type, key_type) = nullptr;
+    node_allocator alloc;
+    Compare cmp;
+
+    /* node allocation */
+
+    template <typename... Args>
+    Node *new_node(Args &&...args) {
+        Node *const node = node_traits::allocate(alloc, 1);
+        try {
+            node_traits::construct(alloc, node, std::forward<Args>(args)...);
+        } catch (...) {
+            node_traits::deallocate(alloc, node, 1);
+            throw;
+        }
+        return node;
+    }
+
+    /**
+     * @brief Node whose pair is built in place from `key` and `args`, the value not even default constructed first
+     */
+    template <typename KeyArg, typename... Args>
+    Node *new_node_piecewise(KeyArg &&key, Args &&...args) {
+        return new_node(
+            std::piecewise_construct, std::forward_as_tuple(std::forward<KeyArg>(key)),
+            std::forward_as_tuple(std::forward<Args>(args)...)
+        );
+    }
 
-    /* AVL low-level operations */
+    void delete_node(Node *node) {
+        node_traits::destroy(alloc, node);
+        node_traits::deallocate(alloc, node, 1);
+    }
 
-    static size_type height(Node const *node) { return node ? node->height : 0; }
+    /* balancing */
 
     static size_type size(Node const *node) { return node ? node->size : 0; }
 
-    static void update(Node *node) {
-        if (node) {
-            node->height = 1 + std::max(height(node->left), height(node->right));
-            node->size   = 1 + size(node->left) + size(node->right);
+    /**
+     * @brief Hang `fresh` where `old` was below `parent`, or make it the root
+     */
+    void replace_child(Node *parent, Node const *old, Node *fresh) {
+        if (!parent) {
+            root = fresh;
+        } else if (parent->left == old) {
+            parent->left = fresh;
+        } else {
+            parent->right = fresh;
+        }
+        if (fresh) {
+            fresh->parent = parent;
         }
     }
 
-    static Node *right_rotate(Node *node) {
-        Node *const left       = node->left;
-        Node *const left_right = left->right;
+    /**
+     * @brief `replace_child` as the balancing policy calls it
+     */
+    auto replacer() {
+        return [this](Node *parent, Node const *old, Node *fresh) { replace_child(parent, old, fresh); };
+    }
 
-        // rotate
-        left->right = node;
-        node->left  = left_right;
+    /**
+     * @brief Walk down from the root looking for `key`
+     *
+     * @param path filled with the nodes visited, ending with the match or with the parent of where `key` belongs
+     * @param depth set to the number of nodes on `path`
+     * @return the node holding `key`, or nullptr
+     */
+    Node *descend(key_type const &key, Node **path, int &depth) const {
+        depth      = 0;
+        Node *node = root;
+        while (node) {
+            path[depth++] = node;
+            if (cmp(key, node->data.first)) {
+                node = node->left;
+            } else if (cmp(node->data.first, key)) {
+                node = node->right;
+            } else {
+                return node;
+            }
+        }
+        return nullptr;
+    }
 
-        // update parent
-        left->parent = node->parent;
-        node->parent = left;
-        if (left_right) {
-            left_right->parent = node;
+    /**
+     * @brief Hang `fresh` below the last node of `path`, as left by a `descend` that found no match, and rebalance
+     */
+    void link_node(Node *fresh, Node **path, int depth) {
+        if (depth == 0) {
+            root = fresh;
+            return;
         }
+        Node *const parent = path[depth - 1];
+        fresh->parent      = parent;
+        (cmp(fresh->data.first, parent->data.first) ? parent->left : parent->right) = fresh;
+        Balance::inserted(path, depth, fresh, replacer());
+    }
 
-        // update height and size
-        update(node);
-        update(left);
+    /**
+     * @brief Node holding `key`, built from `args` and linked if the key is absent
+     *
+     * @return the node, and whether it was inserted
+     */
+    template <typename KeyArg, typename... Args>
+    std::pair<Node *, bool> try_emplace_node(KeyArg &&key, Args &&...args) {
+        Node *path[MAX_HEIGHT];
+        int depth = 0;
+        if (Node *const node = descend(key, path, depth)) {
+            return {node, false};
+        }
+        Node *const fresh = new_node_piecewise(std::forward<KeyArg>(key), std::forward<Args>(args)...);
+        link_node(fresh, path, depth);
+        return {fresh, true};
+    }
 
-        return left;
+    Node *find_node(key_type const &key) const {
+        Node *node = root;
+        while (node) {
+            if (cmp(key, node->data.first)) {
+                node = node->left;
+            } else if (cmp(node->data.first, key)) {
+                node = node->right;
+            } else {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief First node for which `before(node key)` is false, `before` being true on a prefix of the key order
+     *
+     * @param rank set to the number of nodes before the one returned
+     * @return the node, or nullptr when `before` holds for every key
+     */
+    template <typename Before>
+    Node *partition_node(Before before, size_type &rank) const {
+        Node *node  = root;
+        Node *found = nullptr;
+        rank        = 0;
+        while (node) {
+            if (before(node->data.first)) {
+                rank += size(node->left) + 1;
+                node = node->right;
+            } else {
+                found = node;
+                node  = node->left;
+            }
+        }
+        return found;
     }
 
-    static Node *left_rotate(Node *node) {
-        Node *const right      = node->right;
-        Node *const right_left = right->left;
+    Node *lower_bound_node(key_type const &key, size_type &rank) const {
+        return partition_node([this, &key](key_type const &other) { return cmp(other, key); }, rank);
+    }
 
-        // rotate
-        right->left = node;
-        node->right = right_left;
+    Node *upper_bound_node(key_type const &key, size_type &rank) const {
+        return partition_node([this, &key](key_type const &other) { return !cmp(key, other); }, rank);
+    }
 
-        // update parent
-        right->parent = node->parent;
-        node->parent  = right;
-        if (right_left) {
-            right_left->parent = node;
+    /**
+     * @param pos in [1, size(root)], regardless of `BASE_INDEX`
+     */
+    Node *findbypos_node(size_type pos) const {
+        Node *node = root;
+        while (true) {
+            auto const root_pos = size(node->left) + 1;
+            if (pos == root_pos) {
+                return node;
+            }
+            if (pos < root_pos) {
+                node = node->left;
+            } else {
+                pos -= root_pos;
+                node = node->right;
+            }
         }
+    }
 
-        // update height and size
-        update(node);
-        update(right);
+    /**
+     * @brief `find` of `count` keys into `found`, the descents interleaved to overlap their cache misses
+     */
+    void find_nodes(key_type const *keys, size_type count, iterator *found) const {
+        auto const start = [&](size_t i, Node *&node) {
+            node     = root;
+            found[i] = iterator(nullptr);
+            __builtin_prefetch(node);
+            return node != nullptr;
+        };
+        auto const step = [&](size_t i, Node *&node) {
+            if (cmp(keys[i], node->data.first)) {
+                node = node->left;
+            } else if (cmp(node->data.first, keys[i])) {
+                node = node->right;
+            } else {
+                found[i] = iterator(node);
+                return false;
+            }
+            __builtin_prefetch(node);
+            return node != nullptr;
+        };
+        interleave_searches<BATCH_WIDTH, Node *>(count, start, step);
+    }
 
-        return right;
+    /**
+     * @brief `findbypos` of `count` positions into `found`, see `find_nodes`
+     *
+     * Choosing a side takes the size of the left child, a second miss per level: a lane reaching a node first
+     * prefetches that child and yields once more before comparing.
+     */
+    void findbypos_nodes(size_type const *positions, size_type count, iterator *found) const {
+        struct Lane {
+            Node *node;
+            size_type pos;  // in [1, size(node)]
+            bool sized;     // whether the left child of `node` has been prefetched
+        };
+        auto const start = [&](size_t i, Lane &lane) {
+            found[i] = iterator(nullptr);
+            if (positions[i] < BASE_INDEX || positions[i] > size(root)) {
+                return false;
+            }
+            lane = Lane{root, positions[i] - BASE_INDEX + 1, false};
+            __builtin_prefetch(root);
+            return true;
+        };
+        auto const step = [&](size_t i, Lane &lane) {
+            if (!lane.sized) {
+                lane.sized = true;
+                if (lane.node->left) {
+                    __builtin_prefetch(lane.node->left);
+                    return true;
+                }
+            }
+            auto const root_pos = size(lane.node->left) + 1;
+            if (lane.pos == root_pos) {
+                found[i] = iterator(lane.node);
+                return false;
+            }
+            if (lane.pos < root_pos) {
+                lane.node = lane.node->left;
+            } else {
+                lane.pos -= root_pos;
+                lane.node = lane.node->right;
+            }
+            lane.sized = false;
+            __builtin_prefetch(lane.node);
+            return true;
+        };
+        interleave_searches<BATCH_WIDTH, Lane>(count, start, step);
     }
 
-    static balance_type get_balance(Node *node) { return node ? height(node->left) - height(node->right) : 0; }
+    /**
+     * @brief Walk down from the root to the node at `pos`, like `descend` does for a key
+     *
+     * @param pos in [1, size(root)], regardless of `BASE_INDEX`
+     */
+    Node *descend_pos(size_type pos, Node **path, int &depth) const {
+        depth      = 0;
+        Node *node = root;
+        while (true) {
+            path[depth++]       = node;
+            auto const root_pos = size(node->left) + 1;
+            if (pos == root_pos) {
+                return node;
+            }
+            if (pos < root_pos) {
+                node = node->left;
+            } else {
+                pos -= root_pos;
+                node = node->right;
+            }
+        }
+    }
 
-    /* AVL high-level operations */
+    /**
+     * @brief Tree of the nodes of `left`, then `mid`, then those of `right`, in O(log n)
+     *
+     * @note the parent of the returned root is left for the caller to set
+     */
+    static Node *join_nodes(Node *left, Node *mid, Node *right) { return Balance::join(left, mid, right); }
 
-    Node *insert(Node *node, key_type key, value_type value) {
-        if (!node) {  // insert to an empty tree
-            return new Node(key, value);
+    /**
+     * @brief Same as `join_nodes` without a middle node, the first node of `right` takes that role
+     */
+    static Node *join_nodes(Node *left, Node *right) {
+        if (!left || !right) {
+            return left ? left : right;
         }
+        auto const [first, rest] = split_nodes_at(right, 1);
+        return join_nodes(left, first, rest);
+    }
 
-        if (cmp(key, node->data.first)) {
-            auto new_node    = insert(node->left, key, value);
-            node->left       = new_node;
-            new_node->parent = node;
-        } else if (cmp(node->data.first, key)) {
-            auto new_node    = insert(node->right, key, value);
-            node->right      = new_node;
-            new_node->parent = node;
-        } else {
-            // key already exists, update value
-            node->data.second = value;
-            return node;
+    /**
+     * @brief Cut the subtree rooted at `node` into its first `pos` nodes and the rest, both balanced trees
+     *
+     * The joins along the way cost O(log n) in total, since each one works on heights bounded by the previous one,
+     * times the spine walks that measure black heights under `RedBlackBalance`.
+     */
+    static std::pair<Node *, Node *> split_nodes_at(Node *node, size_type pos) {
+        if (!node) {
+            return {nullptr, nullptr};
         }
-
-        // update current node's height and size
-        update(node);
-
-        // rotate
-        if (auto balance = get_balance(node); balance > 1) {
-            if (cmp(key, node->left->data.first)) {
-                // LL
-                return right_rotate(node);
-            } else {
-                // LR
-                node->left = left_rotate(node->left);
-                return right_rotate(node);
-            }
-        } else if (balance < -1) {
-            if (cmp(node->right->data.first, key)) {
-                // RR
-                return left_rotate(node);
-            } else {
-                // RL
-                node->right = right_rotate(node->right);
-                return left_rotate(node);
-            }
+        Node *const left  = orphan(node->left);
+        Node *const right = orphan(node->right);
+        if (size_type const left_size = size(left); pos <= left_size) {
+            auto const [first, rest] = split_nodes_at(left, pos);
+            return {first, orphan(join_nodes(rest, node, right))};
         } else {
-            // no need to rotate
-            return node;
+            auto const [first, rest] = split_nodes_at(right, pos - left_size - 1);
+            return {orphan(join_nodes(left, node, first)), rest};
         }
     }
 
-    Node *find(Node *const node, key_type const &key) const {
+    /**
+     * @brief Cut the subtree rooted at `node` into the nodes before `key`, the one holding it, and those after
+     *
+     * @return the three parts without parents, the middle one detached from any other node, or nullptr
+     */
+    std::tuple<Node *, Node *, Node *> split_nodes(Node *node, key_type const &key) const {
         if (!node) {
-            return nullptr;
+            return {nullptr, nullptr, nullptr};
         }
-
+        Node *const left  = orphan(node->left);
+        Node *const right = orphan(node->right);
         if (cmp(key, node->data.first)) {
-            return find(node->left, key);
+            auto const [before, match, after] = split_nodes(left, key);
+            return {before, match, orphan(join_nodes(after, node, right))};
+        } else if (cmp(node->data.first, key)) {
+            auto const [before, match, after] = split_nodes(right, key);
+            return {orphan(join_nodes(left, node, before)), match, after};
         }
-        if (cmp(node->data.first, key)) {
-            return find(node->right, key);
+        node->left  = nullptr;
+        node->right = nullptr;
+        Balance::update(node);
+        return {left, node, right};
+    }
+
+    static Node *orphan(Node *node) {
+        if (node) {
+            node->parent = nullptr;
         }
         return node;
     }
 
-    Node *findbypos(Node *const node, size_type const &pos) const {
-        auto const left_size = size(node->left);
-        auto const root_pos  = left_size + BASE_INDEX;
-
-        if (pos == root_pos) {
-            return node;
+    /**
+     * @brief Nodes of `that` made ours: taken over when our allocator can free them, copied otherwise
+     */
+    Node *adopt(AvlOrderStatisticTree &that) {
+        if (alloc == that.alloc) {
+            return std::exchange(that.root, nullptr);
         }
-        if (pos < root_pos) {
-            return findbypos(node->left, pos);
+        return clone(that.root);
+    }
+
+    /**
+     * @brief `pool` if the set operations may run on it: nodes are freed from several threads at once, which only a
+     * stateless allocator is trusted with
+     */
+    static ThreadPool *parallel_pool(ThreadPool &pool) {
+        return node_traits::is_always_equal::value && pool.workers() ? &pool : nullptr;
+    }
+
+    /**
+     * @brief Run `f` and `g` in parallel on `pool` when `work` nodes are at stake, one after the other otherwise
+     */
+    template <typename F, typename G>
+    static void fork_join(ThreadPool *pool, size_type work, F const &f, G const &g) {
+        if (pool && work >= PARALLEL_GRAIN) {
+            pool->fork_join(f, g);
+        } else {
+            f();
+            g();
         }
-        return findbypos(node->right, pos - left_size - 1);
     }
 
     /**
-     * @brief Erase a node from the subtree
+     * @brief Union of two subtrees, the values of `theirs` winning on equal keys
      *
-     * @param node the root of the subtree
-     * @param key the key of the node to be erased
-     * @return Node* the new root of the subtree after deletion
+     * `theirs` is split around the root of `mine`, each side merged with the matching subtree of `mine`, and the two
+     * results joined back around that root. Intersection and difference follow the same pattern.
+     */
+    Node *union_nodes(Node *mine, Node *theirs, ThreadPool *pool) {
+        if (!mine || !theirs) {
+            return mine ? mine : theirs;
+        }
+        size_type const work = size(mine) + size(theirs);
+        Node *const left     = orphan(mine->left);
+        Node *const right    = orphan(mine->right);
+        Node *before, *match, *after;
+        std::tie(before, match, after) = split_nodes(theirs, mine->data.first);
+        if (match) {
+            mine->data.second = std::move(match->data.second);
+            delete_node(match);
+        }
+        Node *merged_left, *merged_right;
+        fork_join(
+            pool, work, [&] { merged_left = union_nodes(left, before, pool); },
+            [&] { merged_right = union_nodes(right, after, pool); }
+        );
+        return join_nodes(merged_left, mine, merged_right);
+    }
+
+    /**
+     * @brief Intersection of two subtrees, keeping the values of `mine`
      */
-    Node *erase(Node *node, key_type key) {
-        if (node == nullptr) {  // erase from an empty tree
+    Node *intersect_nodes(Node *mine, Node *theirs, ThreadPool *pool) {
+        if (!mine || !theirs) {
+            free(mine);
+            free(theirs);
             return nullptr;
         }
+        size_type const work = size(mine) + size(theirs);
+        Node *const left     = orphan(mine->left);
+        Node *const right    = orphan(mine->right);
+        Node *before, *match, *after;
+        std::tie(before, match, after) = split_nodes(theirs, mine->data.first);
+        Node *merged_left, *merged_right;
+        fork_join(
+            pool, work, [&] { merged_left = intersect_nodes(left, before, pool); },
+            [&] { merged_right = intersect_nodes(right, after, pool); }
+        );
+        if (match) {
+            delete_node(match);
+            return join_nodes(merged_left, mine, merged_right);
+        }
+        delete_node(mine);
+        return join_nodes(merged_left, merged_right);
+    }
 
-        if (cmp(key, node->data.first)) {
-            node->left = erase(node->left, key);
-        } else if (cmp(node->data.first, key)) {
-            node->right = erase(node->right, key);
-        } else {
-            if (node->left == nullptr || node->right == nullptr) {
-                // 0 or 1 child case
-                Node *child = node->left ? node->left : node->right;
-
-                if (child == nullptr) {
-                    // no child case
-                    delete node;
-                    return nullptr;
-                } else {
-                    // one child case
-                    Node *const old_parent = node->parent;
-                    *node                  = *child;
-                    node->parent           = old_parent;
-                    delete child;
-                }
-            } else {
-                // 2 children case
-                // find min node of right subtree
-                Node *right_min_node = node->right->min_value_node();
+    /**
+     * @brief Nodes of `mine` whose key is not in `theirs`
+     */
+    Node *difference_nodes(Node *mine, Node *theirs, ThreadPool *pool) {
+        if (!mine || !theirs) {
+            free(theirs);
+            return mine;
+        }
+        size_type const work = size(mine) + size(theirs);
+        Node *const left     = orphan(mine->left);
+        Node *const right    = orphan(mine->right);
+        Node *before, *match, *after;
+        std::tie(before, match, after) = split_nodes(theirs, mine->data.first);
+        Node *merged_left, *merged_right;
+        fork_join(
+            pool, work, [&] { merged_left = difference_nodes(left, before, pool); },
+            [&] { merged_right = difference_nodes(right, after, pool); }
+        );
+        if (!match) {
+            return join_nodes(merged_left, mine, merged_right);
+        }
+        delete_node(match);
+        delete_node(mine);
+        return join_nodes(merged_left, merged_right);
+    }
 
-                // replace current node with min node
-                node->data.first  = right_min_node->data.first;
-                node->data.second = right_min_node->data.second;
+    /**
+     * @brief Unlink `node` from the tree and free it
+     *
+     * @param path the nodes from the root down to `node` itself
+     * @param depth number of nodes on `path`
+     */
+    void erase_node(Node *node, Node **path, int depth) {
+        Node *const parent = node->parent;
+        depth--;  // `node` leaves the path
+
+        Node *hole;        // what takes the position that goes away
+        tag_type removed;  // the bookkeeping of the node that left it
+
+        if (node->left && node->right) {
+            // 2 children case: the in-order successor takes over `node`'s place
+            int const node_depth = depth;
+            path[depth++]        = node;
+            Node *successor      = node->right;
+            while (successor->left) {
+                path[depth++] = successor;
+                successor     = successor->left;
+            }
 
-                // delete min node of right subtree
-                node->right = erase(node->right, right_min_node->data.first);
+            hole    = successor->right;
+            removed = *successor;
+            replace_child(successor->parent, successor, hole);
+            static_cast<tag_type &>(*successor) = *node;
+            successor->left                     = node->left;
+            successor->right                    = node->right;
+            successor->size                     = node->size;
+            if (successor->left) {
+                successor->left->parent = successor;
             }
+            if (successor->right) {
+                successor->right->parent = successor;
+            }
+            replace_child(parent, node, successor);
+            path[node_depth] = successor;
+        } else {
+            // 0 or 1 child case
+            hole    = node->left ? node->left : node->right;
+            removed = *node;
+            replace_child(parent, node, hole);
         }
 
-        // update current node
-        update(node);
+        delete_node(node);
+        Balance::erased(path, depth, hole, removed, replacer());
+    }
 
-        // rotate
-        if (auto balance = get_balance(node); balance > 1) {
-            if (get_balance(node->left) >= 0) {
-                // LL
-                return right_rotate(node);
+    void free(Node *node) {
+        if (can_abandon_nodes<K, V>(alloc)) {
+            return;
+        }
+        // rotate left children up so that the tree unrolls into a right spine as it is freed
+        while (node) {
+            if (Node *const left = node->left) {
+                node->left  = left->right;
+                left->right = node;
+                node        = left;
             } else {
-                // LR
-                node->left = left_rotate(node->left);
-                return right_rotate(node);
-            }
-        } else if (balance < -1) {
-            if (get_balance(node->right) <= 0) {
-                // RR
-                return left_rotate(node);
+                Node *const right = node->right;
+                delete_node(node);
+                node = right;
+            }
+        }
+    }
+
+    /**
+     * @brief Link the next `n` nodes handed out by `next_node`, in key order, into a perfectly balanced subtree
+     */
+    template <typename NextNode>
+    static Node *link_balanced(NextNode &next_node, ptrdiff_t n, Node *parent) {
+        if (n <= 0) {
+            return nullptr;
+        }
+        ptrdiff_t const left_size = n / 2;
+
+        Node *const left = link_balanced(next_node, left_size, nullptr);
+        Node *const node = next_node();
+        node->parent     = parent;
+        node->left       = left;
+        node->right      = link_balanced(next_node, n - left_size - 1, node);
+        if (left) {
+            left->parent = node;
+        }
+        Balance::update(node);
+        return node;
+    }
+
+    /**
+     * @brief Perfectly balanced subtree over the `n` pairs from `first`, the same shape `link_balanced` gives
+     *
+     * Both subtrees of a large enough node are built in parallel on `pool`.
+     */
+    template <typename RandomIt>
+    Node *build_balanced(RandomIt first, size_type n, Node *parent, ThreadPool *pool) {
+        if (n == 0) {
+            return nullptr;
+        }
+        size_type const left_size = n / 2;
+
+        Node *const node = new_node(first[left_size].first, first[left_size].second);
+        node->parent     = parent;
+        fork_join(
+            pool, n, [&] { node->left = build_balanced(first, left_size, node, pool); },
+            [&] { node->right = build_balanced(first + left_size + 1, n - left_size - 1, node, pool); }
+        );
+        Balance::update(node);
+        return node;
+    }
+
+    /**
+     * @brief Whether relinking all n + m nodes is cheaper than m descents of log2(n) levels
+     */
+    bool rebuild_pays_off(size_type batch_size) const {
+        size_type const n = size(root);
+        size_type depth   = 1;
+        while (depth < std::numeric_limits<size_type>::digits && (size_type(1) << depth) <= n) {
+            depth++;
+        }
+        return batch_size * depth >= n + batch_size;
+    }
+
+    /**
+     * @brief Rebuild the tree as a perfectly balanced one over `nodes`, given in key order
+     */
+    void relink(std::vector<Node *> const &nodes) {
+        auto next_node = [itor = nodes.begin()]() mutable { return *itor++; };
+        root           = link_balanced(next_node, nodes.size(), nullptr);
+        Balance::rebuilt(root);
+    }
+
+    /**
+     * @brief Copy of the subtree rooted at `src` with the same shape and bookkeeping, in O(n) without comparisons
+     *
+     * Both trees are walked in step through the parent links, the copy always mirroring the source node.
+     */
+    Node *clone(Node const *src) {
+        if (!src) {
+            return nullptr;
+        }
+        Node *const copy_root = copy_node(src, nullptr);
+        Node const *node      = src;
+        Node *copy            = copy_root;
+        while (true) {
+            if (node->left && !copy->left) {
+                copy->left = copy_node(node->left, copy);
+                node       = node->left;
+                copy       = copy->left;
+            } else if (node->right && !copy->right) {
+                copy->right = copy_node(node->right, copy);
+                node        = node->right;
+                copy        = copy->right;
+            } else if (node != src) {
+                node = node->parent;
+                copy = copy->parent;
             } else {
-                // RL
-                node->right = right_rotate(node->right);
-                return left_rotate(node);
+                return copy_root;
             }
-        } else {
-            // no need to rotate
-            return node;
         }
     }
 
-    static void free(Node *node) {
-        if (node) {
-            free(node->left);
-            free(node->right);
-            delete node;
+    Node *copy_node(Node const *node, Node *parent) {
+        Node *const copy               = new_node(node->data.first, node->data.second);
+        static_cast<tag_type &>(*copy) = *node;
+        copy->size                     = node->size;
+        copy->parent                   = parent;
+        return copy;
+    }
+
+    static Compare order_of(bool (*cmp)(key_type, key_type)) {
+        if constexpr (std::is_same_v<Compare, directional_less<key_type>>) {
+            if (cmp != less && cmp != greater) {
+                throw std::invalid_argument("directional_less only takes the order of `less` or `greater`");
+            }
+            return Compare(cmp == less);
+        } else {
+            return Compare(cmp);
         }
     }
 
@@ -426,58 +881,212 @@ class AvlOrderStatisticTree {
     static bool greater(key_type a, key_type b) { return a > b; }
 
   public:
-    AvlOrderStatisticTree(bool (*cmp)(key_type, key_type) = less) : root(nullptr), cmp(cmp) {}
+    explicit AvlOrderStatisticTree(Compare const &cmp = Compare(), Allocator const &alloc = Allocator())
+        : root(nullptr), alloc(alloc), cmp(cmp) {}
+    explicit AvlOrderStatisticTree(Allocator const &alloc) : AvlOrderStatisticTree(Compare(), alloc) {}
+    template <typename InputIt>
+    AvlOrderStatisticTree(
+        InputIt first, InputIt last, Compare const &cmp = Compare(), Allocator const &alloc = Allocator()
+    )
+        : AvlOrderStatisticTree(cmp, alloc) {
+        assign(first, last);
+    }
+    /**
+     * @brief Runtime order through `less`/`greater`, for `directional_less` (see `DirectionalAvlOrderStatisticTree`) or
+     * a `Compare` built from a function pointer
+     *
+     * @throw std::invalid_argument if `directional_less` is handed any other function than `less` or `greater`
+     */
+    template <
+        typename C = Compare, std::enable_if_t<
+                                  std::is_constructible_v<C, bool (*)(key_type, key_type)> ||
+                                      std::is_same_v<C, directional_less<key_type>>,
+                                  int> = 0>
+    AvlOrderStatisticTree(bool (*cmp)(key_type, key_type), Allocator const &alloc = Allocator())
+        : AvlOrderStatisticTree(order_of(cmp), alloc) {}
+
+    AvlOrderStatisticTree(AvlOrderStatisticTree const &that)
+        : root(nullptr), alloc(node_traits::select_on_container_copy_construction(that.alloc)), cmp(that.cmp) {
+        root = clone(that.root);
+    }
 
-    AvlOrderStatisticTree(AvlOrderStatisticTree const &) = delete;
+    AvlOrderStatisticTree(AvlOrderStatisticTree &&that) noexcept
+        : root(std::exchange(that.root, nullptr)), alloc(std::move(that.alloc)), cmp(std::move(that.cmp)) {}
 
     ~AvlOrderStatisticTree() { free(root); }
 
-    void Depose() { free(root); }
+    void Depose() {
+        free(root);
+        root = nullptr;
+    }
+    void clear() { Depose(); }
+
+    allocator_type get_allocator() const { return allocator_type(alloc); }
 
-    iterator begin() { return iterator(root->min_value_node()); }
+    iterator begin() { return iterator(root ? root->min_value_node() : nullptr); }
     iterator end() { return iterator(nullptr); }
-    const_iterator begin() const { return const_iterator(root->min_value_node()); }
+    const_iterator begin() const { return const_iterator(root ? root->min_value_node() : nullptr); }
     const_iterator end() const { return const_iterator(nullptr); }
 
-    const_iterator cbegin() const { return const_iterator(root->min_value_node()); }
+    const_iterator cbegin() const { return const_iterator(root ? root->min_value_node() : nullptr); }
     const_iterator cend() const { return const_iterator(nullptr); }
 
-    iterator last() { return iterator(root->max_value_node()); }
+    iterator last() { return iterator(root ? root->max_value_node() : nullptr); }
+
+    key_compare key_comp() const { return cmp; }
 
     size_type size() { return size(root); }
 
-    void insert(std::pair<key_type, value_type> const &p) { insert(p.first, p.second); }
+    void insert(std::pair<key_type, value_type> const &p) { insert_or_assign(p.first, p.second); }
+    void insert(std::pair<key_type, value_type> &&p) { insert_or_assign(std::move(p.first), std::move(p.second)); }
+
+    /**
+     * @brief Insert the pair, or update the value if the key already exists
+     */
+    void insert(key_type const &key, value_type const &value) { insert_or_assign(key, value); }
+    void insert(key_type const &key, value_type &&value) { insert_or_assign(key, std::move(value)); }
+
+    /**
+     * @brief Insert a value built in place from `args` if `key` is absent, leave the map untouched otherwise
+     *
+     * @return the element holding `key`, and whether it was inserted
+     */
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(key_type const &key, Args &&...args) {
+        auto const [node, inserted] = try_emplace_node(key, std::forward<Args>(args)...);
+        return {iterator(node), inserted};
+    }
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(key_type &&key, Args &&...args) {
+        auto const [node, inserted] = try_emplace_node(std::move(key), std::forward<Args>(args)...);
+        return {iterator(node), inserted};
+    }
 
-    void insert(key_type key, value_type value) { root = insert(root, key, value); }
+    /**
+     * @brief Insert the pair, or assign `value` to the existing element, forwarding it either way
+     *
+     * @return the element holding `key`, and whether it was inserted
+     */
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(key_type const &key, M &&value) {
+        auto const [node, inserted] = try_emplace_node(key, std::forward<M>(value));
+        if (!inserted) {
+            node->data.second = std::forward<M>(value);
+        }
+        return {iterator(node), inserted};
+    }
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(key_type &&key, M &&value) {
+        auto const [node, inserted] = try_emplace_node(std::move(key), std::forward<M>(value));
+        if (!inserted) {
+            node->data.second = std::forward<M>(value);
+        }
+        return {iterator(node), inserted};
+    }
+
+    /**
+     * @brief Build the pair from `args` right in its node, keep it if its key is absent
+     *
+     * @return the element holding the key, and whether it was inserted
+     */
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args &&...args) {
+        Node *const fresh = new_node(std::forward<Args>(args)...);
+        Node *path[MAX_HEIGHT];
+        int depth = 0;
+        if (Node *const node = descend(fresh->data.first, path, depth)) {
+            delete_node(fresh);
+            return {iterator(node), false};
+        }
+        link_node(fresh, path, depth);
+        return {iterator(fresh), true};
+    }
 
     AvlOrderStatisticTree &operator=(AvlOrderStatisticTree const &that) {
         if (&that == this)
             return *this;
 
-        this->free(this->root);
+        Depose();
+        this->cmp  = that.cmp;
+        this->root = clone(that.root);
+        return *this;
+    }
+
+    /**
+     * @note nodes are only taken over when the allocators can free each other's memory, they are copied otherwise
+     */
+    AvlOrderStatisticTree &operator=(AvlOrderStatisticTree &&that) noexcept(
+        node_traits::propagate_on_container_move_assignment::value || node_traits::is_always_equal::value
+    ) {
+        if (&that == this)
+            return *this;
 
-        this->cmp = that.cmp;
-        // for (auto itor = that.cbegin(); itor != that.cend(); ++itor) {
-        //     this->insert(itor->data.first, itor->data.second);
-        // }
-        for (auto &[key, val] : that) {
-            this->insert(key, val);
+        if constexpr (!node_traits::propagate_on_container_move_assignment::value) {
+            if (alloc != that.alloc) {
+                *this = that;
+                that.clear();
+                return *this;
+            }
+        }
+        Depose();
+        if constexpr (node_traits::propagate_on_container_move_assignment::value) {
+            this->alloc = std::move(that.alloc);
         }
+        this->cmp  = std::move(that.cmp);
+        this->root = std::exchange(that.root, nullptr);
         return *this;
     }
 
     /**
-     * @note this function will not handle error when key not found, use `at` or `find` instead
+     * @brief Replace the content with the pairs in [first, last) in O(n), laid out as a perfectly balanced tree
+     *
+     * @note the range must be sorted by `key_comp()` and free of duplicate keys, use `assign` otherwise
      */
-    reference operator[](key_type const &key) {
-        if (auto itor = find(key); itor != end()) {
-            return itor->second;
-        } else {
-            insert(key, value_type());
-            return reference(at(key));
-        }
+    template <typename ForwardIt>
+    void build_from_sorted(ForwardIt first, ForwardIt last) {
+        Depose();
+        auto next_node = [this, &first] {
+            Node *const node = new_node(first->first, first->second);
+            ++first;
+            return node;
+        };
+        root = link_balanced(next_node, std::distance(first, last), nullptr);
+        Balance::rebuilt(root);
+    }
+
+    /**
+     * @brief Same as `build_from_sorted`, the two halves of every large subtree allocated and linked in parallel
+     *
+     * @note the nodes are allocated from several threads, so this runs sequentially unless the allocator is stateless
+     */
+    template <typename RandomIt>
+    void build_from_sorted(RandomIt first, RandomIt last, ThreadPool &pool) {
+        Depose();
+        root = build_balanced(first, last - first, nullptr, parallel_pool(pool));
+        Balance::rebuilt(root);
+    }
+
+    /**
+     * @brief Replace the content with the pairs in [first, last) in any order, later duplicates win like `insert`
+     */
+    template <typename InputIt>
+    void assign(InputIt first, InputIt last) {
+        std::vector<pair_type> pairs(first, last);
+        sort_unique_by_key(pairs, cmp);
+        build_from_sorted(pairs.begin(), pairs.end());
     }
 
+    /**
+     * @brief Immutable snapshot of the current content, for lookups by key and position on a map that rarely changes
+     */
+    FrozenOrderStatistic<K, V, Compare, Allocator> freeze() const { return {begin(), end(), cmp, get_allocator()}; }
+
+    /**
+     * @note this function will not handle error when key not found, use `at` or `find` instead
+     */
+    reference operator[](key_type const &key) { return try_emplace_node(key).first->data.second; }
+    reference operator[](key_type &&key) { return try_emplace_node(std::move(key)).first->data.second; }
+
     reference at(key_type const &key) {
         if (auto itor = find(key); itor == end()) {
             throw std::out_of_range("key not found");
@@ -486,7 +1095,7 @@ class AvlOrderStatisticTree {
         }
     }
 
-    iterator find(key_type const &key) const { return iterator(find(root, key)); }
+    iterator find(key_type const &key) const { return iterator(find_node(key)); }
 
     /**
      * @brief Find the node by position
@@ -498,10 +1107,303 @@ class AvlOrderStatisticTree {
         if (pos < BASE_INDEX || pos > size(root)) {
             return iterator(nullptr);
         }
-        return iterator(findbypos(root, pos));
+        return iterator(findbypos_node(pos - BASE_INDEX + 1));
+    }
+
+    /**
+     * @brief Number of keys before `key`, whether `key` is present or not
+     *
+     * @note a present key is found at `findbypos(rank(key) + BASE_INDEX)`
+     */
+    size_type rank(key_type const &key) const {
+        size_type rank = 0;
+        lower_bound_node(key, rank);
+        return rank;
+    }
+
+    /**
+     * @brief First element whose key is not before `key`
+     */
+    iterator lower_bound(key_type const &key) const {
+        size_type rank = 0;
+        return iterator(lower_bound_node(key, rank));
+    }
+
+    /**
+     * @brief First element whose key is after `key`
+     */
+    iterator upper_bound(key_type const &key) const {
+        size_type rank = 0;
+        return iterator(upper_bound_node(key, rank));
+    }
+
+    /**
+     * @brief Number of keys in [lo, hi), two descents whatever the count
+     */
+    size_type count_range(key_type const &lo, key_type const &hi) const {
+        if (!cmp(lo, hi)) {
+            return 0;
+        }
+        return rank(hi) - rank(lo);
+    }
+
+    /**
+     * @brief `find` of every key, `BATCH_WIDTH` descents advanced in lock-step so their cache misses overlap
+     *
+     * @note pays off once the tree outgrows the cache, a small batch or tree is better served by `find`
+     */
+    std::vector<iterator> find_batch(std::vector<key_type> const &keys) const {
+        std::vector<iterator> found(keys.size());
+        find_nodes(keys.data(), keys.size(), found.data());
+        return found;
+    }
+
+    /**
+     * @brief `findbypos` of every position, see `find_batch`
+     */
+    std::vector<iterator> findbypos_batch(std::vector<size_type> const &positions) const {
+        std::vector<iterator> found(positions.size());
+        findbypos_nodes(positions.data(), positions.size(), found.data());
+        return found;
+    }
+
+    /**
+     * @brief `find_batch` split into chunks resolved in parallel on `pool`
+     */
+    std::vector<iterator>
+    find_many(std::vector<key_type> const &keys, ThreadPool &pool = ThreadPool::instance()) const {
+        std::vector<iterator> found(keys.size());
+        pool.parallel_for(0, keys.size(), PARALLEL_GRAIN, [&](size_t first, size_t last) {
+            find_nodes(keys.data() + first, last - first, found.data() + first);
+        });
+        return found;
+    }
+
+    /**
+     * @brief `findbypos_batch` split into chunks resolved in parallel on `pool`
+     */
+    std::vector<iterator>
+    findbypos_many(std::vector<size_type> const &positions, ThreadPool &pool = ThreadPool::instance()) const {
+        std::vector<iterator> found(positions.size());
+        pool.parallel_for(0, positions.size(), PARALLEL_GRAIN, [&](size_t first, size_t last) {
+            findbypos_nodes(positions.data() + first, last - first, found.data() + first);
+        });
+        return found;
+    }
+
+    /**
+     * @brief All pairs in key order, copied by chunks of positions in parallel on `pool`
+     *
+     * Each run of chunks starts from its first position, found through the subtree sizes, then walks in order. The
+     * chunks are moved into the result in order afterwards.
+     */
+    std::vector<pair_type> to_vector(ThreadPool &pool = ThreadPool::instance()) const {
+        size_t const count = size(root);
+        std::vector<std::vector<pair_type>> chunks((count + PARALLEL_GRAIN - 1) / PARALLEL_GRAIN);
+        pool.parallel_for(0, chunks.size(), 1, [&](size_t first, size_t last) {
+            Node const *node = findbypos_node(first * PARALLEL_GRAIN + 1);
+            for (size_t chunk = first; chunk < last; chunk++) {
+                size_t const length = std::min(PARALLEL_GRAIN, count - chunk * PARALLEL_GRAIN);
+                chunks[chunk].reserve(length);
+                for (size_t i = 0; i < length; i++, node = node->next()) {
+                    chunks[chunk].emplace_back(node->data);
+                }
+            }
+        });
+        std::vector<pair_type> pairs;
+        pairs.reserve(count);
+        for (auto &chunk : chunks) {
+            pairs.insert(pairs.end(), std::make_move_iterator(chunk.begin()), std::make_move_iterator(chunk.end()));
+        }
+        return pairs;
+    }
+
+    /**
+     * @brief Insert or update every pair of [first, last)
+     *
+     * The batch is sorted first. When it is large enough for a linear pass to beat one descent per key, it is merged
+     * with the in-order sequence of the tree and the whole tree is relinked at once, touching every node once.
+     */
+    template <typename InputIt>
+    void insert_batch(InputIt first, InputIt last) {
+        std::vector<pair_type> batch(first, last);
+        sort_unique_by_key(batch, cmp);
+        if (!rebuild_pays_off(batch.size())) {
+            for (auto &[key, value] : batch) {
+                insert_or_assign(std::move(key), std::move(value));
+            }
+            return;
+        }
+
+        std::vector<Node *> nodes;
+        nodes.reserve(size(root) + batch.size());
+        auto itor = batch.begin();
+        for (Node *node = root ? root->min_value_node() : nullptr; node; node = node->next()) {
+            for (; itor != batch.end() && cmp(itor->first, node->data.first); ++itor) {
+                nodes.push_back(new_node(std::move(*itor)));
+            }
+            if (itor != batch.end() && !cmp(node->data.first, itor->first)) {
+                node->data.second = std::move(itor->second);
+                ++itor;
+            }
+            nodes.push_back(node);
+        }
+        for (; itor != batch.end(); ++itor) {
+            nodes.push_back(new_node(std::move(*itor)));
+        }
+        relink(nodes);
+    }
+
+    /**
+     * @brief Erase every key of [first, last), see `insert_batch`
+     *
+     * @return the number of elements erased
+     */
+    template <typename InputIt>
+    size_type erase_batch(InputIt first, InputIt last) {
+        std::vector<key_type> keys(first, last);
+        std::sort(keys.begin(), keys.end(), cmp);
+        size_type const old_size = size(root);
+        if (!rebuild_pays_off(keys.size())) {
+            for (auto const &key : keys) {
+                erase(key);
+            }
+            return old_size - size(root);
+        }
+
+        std::vector<Node *> kept, erased;
+        kept.reserve(old_size);
+        auto itor = keys.begin();
+        for (Node *node = root ? root->min_value_node() : nullptr; node; node = node->next()) {
+            for (; itor != keys.end() && cmp(*itor, node->data.first); ++itor) {
+            }
+            (itor != keys.end() && !cmp(node->data.first, *itor) ? erased : kept).push_back(node);
+        }
+        // the in-order walk climbs through parents, so only free once it is over
+        for (Node *node : erased) {
+            delete_node(node);
+        }
+        relink(kept);
+        return erased.size();
+    }
+
+    /**
+     * @brief Move the elements whose key is not before `key` into a new tree, in O(log n)
+     */
+    AvlOrderStatisticTree split(key_type const &key) {
+        auto const [before, match, after] = split_nodes(root, key);
+        AvlOrderStatisticTree rest(cmp, get_allocator());
+        root      = before;
+        rest.root = match ? orphan(join_nodes(nullptr, match, after)) : after;
+        return rest;
+    }
+
+    /**
+     * @brief Move the elements from position `pos` on into a new tree, in O(log n)
+     *
+     * @note base index decided by `BASE_INDEX`
+     */
+    AvlOrderStatisticTree split_at(size_type pos) {
+        size_type const count      = std::min(std::max<size_type>(pos, BASE_INDEX) - BASE_INDEX, size(root));
+        auto const [before, after] = split_nodes_at(root, count);
+        AvlOrderStatisticTree rest(cmp, get_allocator());
+        root      = before;
+        rest.root = after;
+        return rest;
+    }
+
+    /**
+     * @brief Append the elements of `right` in O(log n), the inverse of `split`
+     *
+     * @note every key of `right` must come after every key of this tree, `right` is consumed, pass a copy to keep it
+     */
+    void join(AvlOrderStatisticTree &&right) { root = orphan(join_nodes(root, adopt(right))); }
+
+    /**
+     * @brief Add the elements of `other`, its values replacing those of equal keys
+     *
+     * Join-based, O(m log(n / m + 1)) work for sizes m <= n, so merging a small delta into a large map costs about
+     * its own size in descents. Both halves of each recursion large enough run in parallel on `pool`.
+     *
+     * @note runs sequentially unless the allocator is stateless, a stateful one (an arena) is not trusted to free
+     * nodes from several threads at once
+     * @note `other` is consumed, its nodes are reused, pass a copy to keep it
+     */
+    void union_with(AvlOrderStatisticTree &&other, ThreadPool &pool = ThreadPool::instance()) {
+        root = orphan(union_nodes(root, adopt(other), parallel_pool(pool)));
+    }
+
+    /**
+     * @brief Keep only the keys also in `other`, see `union_with`
+     */
+    void intersect_with(AvlOrderStatisticTree &&other, ThreadPool &pool = ThreadPool::instance()) {
+        root = orphan(intersect_nodes(root, adopt(other), parallel_pool(pool)));
+    }
+
+    /**
+     * @brief Erase the keys that are in `other`, see `union_with`
+     */
+    void difference_with(AvlOrderStatisticTree &&other, ThreadPool &pool = ThreadPool::instance()) {
+        root = orphan(difference_nodes(root, adopt(other), parallel_pool(pool)));
+    }
+
+    /**
+     * @brief Erase the element at `pos`, with a single descent
+     *
+     * @note base index decided by `BASE_INDEX`
+     * @return whether `pos` was in range
+     */
+    bool erase_at(size_type pos) {
+        if (pos < BASE_INDEX || pos >= size(root) + BASE_INDEX) {
+            return false;
+        }
+        Node *path[MAX_HEIGHT];
+        int depth        = 0;
+        Node *const node = descend_pos(pos - BASE_INDEX + 1, path, depth);
+        erase_node(node, path, depth);
+        return true;
     }
 
-    void erase(key_type key) { root = erase(root, key); }
+    /**
+     * @brief Erase the elements at positions [first_pos, last_pos), clipped to the tree
+     *
+     * The run is split off the tree and the two remaining parts joined back, so the cost is O(log n) plus freeing the
+     * k erased nodes, instead of k descents.
+     *
+     * @note base index decided by `BASE_INDEX`
+     * @return the number of elements erased
+     */
+    size_type erase_positions(size_type first_pos, size_type last_pos) {
+        size_type const first = std::max<size_type>(first_pos, BASE_INDEX) - BASE_INDEX;
+        size_type const last  = std::min<size_type>(last_pos - std::min<size_type>(last_pos, BASE_INDEX), size(root));
+        if (first >= last) {
+            return 0;
+        }
+        if (last - first == 1) {
+            return erase_at(first + BASE_INDEX);
+        }
+        auto const [before, rest]  = split_nodes_at(root, first);
+        auto const [erased, after] = split_nodes_at(rest, last - first);
+        free(erased);
+        root = join_nodes(before, after);
+        if (root) {
+            root->parent = nullptr;
+        }
+        return last - first;
+    }
+
+    void erase(key_type const &key) {
+        Node *path[MAX_HEIGHT];
+        int depth = 0;
+        if (Node *const node = descend(key, path, depth)) {
+            erase_node(node, path, depth);
+        }
+    }
+
+    /**
+     * @brief Walk the whole tree checking parent links, sizes, key order and the invariant of `Balance`, for tests
+     */
+    bool check_invariants() const { return checked(root, nullptr, nullptr, nullptr) >= 0; }
 
     void print_tree() {
         std::cout << "-- AVL Order Statistic Tree --" << std::endl;
@@ -513,7 +1415,7 @@ class AvlOrderStatisticTree {
         if (!node)
             return;
 
-        int height = node->height;
+        int height = levels(node);
         int width  = (1 << height) - 1;
 
         auto res = std::vector(height, std::vector<std::string>(width, " "));
@@ -545,4 +1447,34 @@ class AvlOrderStatisticTree {
             std::cout << std::endl;
         }
     }
+
+  private:
+    static int levels(Node const *node) { return node ? 1 + std::max(levels(node->left), levels(node->right)) : 0; }
+
+    /**
+     * @param lower,upper the nearest ancestors `node` hangs right and left of, its key must lie strictly between theirs
+     * @return the measure `Balance::check` gives the subtree of `node`, or -1 on the first broken invariant
+     */
+    int checked(Node const *node, Node const *parent, Node const *lower, Node const *upper) const {
+        if (!node) {
+            return 0;
+        }
+        if (node->parent != parent || (lower && !cmp(lower->data.first, node->data.first)) ||
+            (upper && !cmp(node->data.first, upper->data.first)) ||
+            node->size != 1 + size(node->left) + size(node->right)) {
+            return -1;
+        }
+        int const left  = checked(node->left, node, lower, node);
+        int const right = left < 0 ? -1 : checked(node->right, node, node, upper);
+        return right < 0 ? -1 : Balance::check(node, left, right);
+    }
 };
+
+/**
+ * @brief `AvlOrderStatisticTree` ordered by a direction chosen at construction, through the `less`/`greater`
+ * constructor or `directional_less(false)`
+ */
+template <
+    typename K, typename V, typename Allocator = std::allocator<std::pair<const K, V>>, typename SizeT = size_t,
+    typename Balance = AvlBalance>
+using DirectionalAvlOrderStatisticTree = AvlOrderStatisticTree<K, V, directional_less<K>, Allocator, SizeT, Balance>;
@@ -0,0 +1,545 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+/**
+ * @brief Rotations and size bookkeeping shared by the balancing policies of `AvlOrderStatisticTree`
+ *
+ * A node has `left`, `right`, `parent` and `size` members and inherits the `Tag` of its policy, whatever that policy
+ * balances on. A policy provides:
+ * - `Tag` and `MAX_HEIGHT`, the longest root to leaf path it allows on a tree of 2^64 - 1 nodes
+ * - `refresh(node)`, recomputing the tag of `node` from its children
+ * - `inserted(path, depth, fresh, replace)`, called once `fresh` hangs below the last node of `path`
+ * - `erased(path, depth, hole, removed, replace)`, called once the node at the end of `path` lost a child position,
+ *   `hole` now filling it and `removed` the tag of the node that went away
+ * - `join(left, mid, right)`, the tree of the nodes of `left`, then `mid`, then those of `right`
+ * - `rebuilt(root)`, called on a tree just linked perfectly balanced by `update` alone
+ * - `check(node, left, right)`, for tests: the measure of the subtree of `node` given those of its children, an empty
+ *   subtree measuring 0, or -1 if `node` breaks the invariant
+ *
+ * Both fix-ups get sizes along `path` still counting the old content, and hang rotated subtrees with
+ * `replace(parent, old, fresh)`, which also sets the root.
+ */
+template <typename Policy>
+struct BinaryTreeBalance {
+    template <typename Node>
+    static auto size(Node const *node) {
+        return node ? node->size : decltype(node->size)(0);
+    }
+
+    template <typename Node>
+    static void update(Node *node) {
+        node->size = 1 + size(node->left) + size(node->right);
+        Policy::refresh(node);
+    }
+
+    template <typename Node>
+    static void refresh(Node *) {}
+
+    template <typename Node>
+    static void rebuilt(Node *) {}
+
+    /**
+     * @brief Hang `left` and `right` below `mid`
+     */
+    template <typename Node>
+    static Node *link(Node *left, Node *mid, Node *right) {
+        mid->left  = left;
+        mid->right = right;
+        if (left) {
+            left->parent = mid;
+        }
+        if (right) {
+            right->parent = mid;
+        }
+        update(mid);
+        return mid;
+    }
+
+    template <typename Node>
+    static Node *right_rotate(Node *node) {
+        Node *const left       = node->left;
+        Node *const left_right = left->right;
+
+        // rotate
+        left->right = node;
+        node->left  = left_right;
+
+        // update parent
+        left->parent = node->parent;
+        node->parent = left;
+        if (left_right) {
+            left_right->parent = node;
+        }
+
+        // update bookkeeping
+        update(node);
+        update(left);
+
+        return left;
+    }
+
+    template <typename Node>
+    static Node *left_rotate(Node *node) {
+        Node *const right      = node->right;
+        Node *const right_left = right->left;
+
+        // rotate
+        right->left = node;
+        node->right = right_left;
+
+        // update parent
+        right->parent = node->parent;
+        node->parent  = right;
+        if (right_left) {
+            right_left->parent = node;
+        }
+
+        // update bookkeeping
+        update(node);
+        update(right);
+
+        return right;
+    }
+};
+
+/**
+ * @brief AVL balance: the heights of two siblings differ by at most one
+ *
+ * The shallowest trees of the three, so the fastest lookups, at the cost of a byte of height per node and of the most
+ * rotations on random updates.
+ */
+struct AvlBalance : BinaryTreeBalance<AvlBalance> {
+    static constexpr int MAX_HEIGHT = 96;  // AVL height stays below 1.45 * log2(n + 2), this covers any 64-bit size
+
+    struct Tag {
+        std::uint8_t height = 1;  // below MAX_HEIGHT
+    };
+
+    template <typename Node>
+    static int height(Node const *node) {
+        return node ? node->height : 0;
+    }
+
+    template <typename Node>
+    static void refresh(Node *node) {
+        node->height = 1 + std::max(height(node->left), height(node->right));
+    }
+
+    template <typename Node, typename Replace>
+    static void inserted(Node **path, int depth, Node *, Replace const &replace) {
+        retrace(path, depth, +1, replace);
+    }
+
+    template <typename Node, typename Replace>
+    static void erased(Node **path, int depth, Node *, Tag, Replace const &replace) {
+        retrace(path, depth, -1, replace);
+    }
+
+    /**
+     * @brief The height, once checked against those of the children
+     */
+    template <typename Node>
+    static int check(Node const *node, int left, int right) {
+        bool const valid = std::abs(left - right) <= 1 && node->height == 1 + std::max(left, right);
+        return valid ? node->height : -1;
+    }
+
+    /**
+     * @brief In O(|height(left) - height(right)|): `mid` goes down the spine of the taller tree to where the heights
+     * match, the path is rebalanced on the way up
+     *
+     * @note the parent of the returned root is left for the caller to set
+     */
+    template <typename Node>
+    static Node *join(Node *left, Node *mid, Node *right) {
+        if (height(left) > height(right) + 1) {
+            left->right         = join(left->right, mid, right);
+            left->right->parent = left;
+            update(left);
+            return rebalance(left);
+        }
+        if (height(right) > height(left) + 1) {
+            right->left         = join(left, mid, right->left);
+            right->left->parent = right;
+            update(right);
+            return rebalance(right);
+        }
+        return link(left, mid, right);
+    }
+
+  private:
+    template <typename Node>
+    static int get_balance(Node const *node) {
+        return node ? height(node->left) - height(node->right) : 0;
+    }
+
+    /**
+     * @brief Rotate `node` back into AVL shape if its children differ in height by more than one
+     *
+     * @return the root of the subtree after rotation
+     */
+    template <typename Node>
+    static Node *rebalance(Node *node) {
+        if (auto balance = get_balance(node); balance > 1) {
+            if (get_balance(node->left) < 0) {
+                // LR
+                node->left = left_rotate(node->left);
+            }
+            return right_rotate(node);
+        } else if (balance < -1) {
+            if (get_balance(node->right) > 0) {
+                // RL
+                node->right = right_rotate(node->right);
+            }
+            return left_rotate(node);
+        }
+        return node;
+    }
+
+    /**
+     * @brief Fix heights and sizes bottom-up along `path` after its last node gained or lost a descendant
+     *
+     * Once a subtree keeps its height, nothing above it can rotate, so the rest of the path only gets its size bumped.
+     *
+     * @param delta +1 after an insertion, -1 after an erasure
+     */
+    template <typename Node, typename Replace>
+    static void retrace(Node **path, int depth, int delta, Replace const &replace) {
+        while (depth > 0) {
+            Node *const node       = path[--depth];
+            int const old_height   = node->height;
+            Node *const old_parent = node->parent;
+
+            update(node);
+            Node *const subtree = rebalance(node);
+            if (subtree != node) {
+                replace(old_parent, node, subtree);
+            }
+            if (subtree->height == old_height) {
+                break;
+            }
+        }
+        while (depth > 0) {
+            path[--depth]->size += delta;
+        }
+    }
+};
+
+/**
+ * @brief Weight balance, BB[α] with α = 1/4: neither subtree of a node weighs more than 3 times the other, the weight
+ * of a subtree being its size plus one
+ *
+ * It balances on the sizes the tree keeps for positions anyway, so nodes carry nothing more, and a subtree has to
+ * outgrow its sibling by a constant factor before anything rotates, so random updates rotate the least of the three.
+ * Every node on the path of an update is checked, single and double rotations are chosen as in Blelloch, Ferizovic
+ * and Sun's weight-balanced join, which with this α keeps insertion, erasure and join in balance.
+ */
+struct WeightBalance : BinaryTreeBalance<WeightBalance> {
+    static constexpr int MAX_HEIGHT = 160;  // a child weighs at most 3/4 of its parent, log_{4/3}(2^64) is below 155
+
+    struct Tag {};
+
+    template <typename Node, typename Replace>
+    static void inserted(Node **path, int depth, Node *, Replace const &replace) {
+        retrace(path, depth, replace);
+    }
+
+    template <typename Node, typename Replace>
+    static void erased(Node **path, int depth, Node *, Tag, Replace const &replace) {
+        retrace(path, depth, replace);
+    }
+
+    template <typename Node>
+    static int check(Node const *node, int, int) {
+        return balanced(weight(node->left), weight(node->right)) ? 0 : -1;
+    }
+
+    /**
+     * @brief In O(log(weight(left) / weight(right))): `mid` goes down the spine of the heavier tree to where the
+     * weights are within a factor 3, the path is rebalanced on the way up
+     *
+     * @note the parent of the returned root is left for the caller to set
+     */
+    template <typename Node>
+    static Node *join(Node *left, Node *mid, Node *right) {
+        if (weight(left) > 3 * weight(right)) {
+            left->right         = join(left->right, mid, right);
+            left->right->parent = left;
+            update(left);
+            return rebalance(left);
+        }
+        if (weight(right) > 3 * weight(left)) {
+            right->left         = join(left, mid, right->left);
+            right->left->parent = right;
+            update(right);
+            return rebalance(right);
+        }
+        return link(left, mid, right);
+    }
+
+  private:
+    template <typename Node>
+    static std::uint64_t weight(Node const *node) {
+        return std::uint64_t(size(node)) + 1;
+    }
+
+    static bool balanced(std::uint64_t a, std::uint64_t b) { return a <= 3 * b && b <= 3 * a; }
+
+    /**
+     * @brief Rotate `node` back into balance if one subtree outweighs the other, once or twice depending on whether a
+     * single rotation would leave the new root balanced
+     *
+     * @return the root of the subtree after rotation
+     */
+    template <typename Node>
+    static Node *rebalance(Node *node) {
+        if (Node *const left = node->left; weight(left) > 3 * weight(node->right)) {
+            std::uint64_t const inner = weight(left->right), outer = weight(node->right);
+            if (!balanced(weight(left->left), inner + outer) || !balanced(inner, outer)) {
+                // LR
+                node->left = left_rotate(left);
+            }
+            return right_rotate(node);
+        }
+        if (Node *const right = node->right; weight(right) > 3 * weight(node->left)) {
+            std::uint64_t const inner = weight(right->left), outer = weight(node->left);
+            if (!balanced(weight(right->right), inner + outer) || !balanced(inner, outer)) {
+                // RL
+                node->right = right_rotate(right);
+            }
+            return left_rotate(node);
+        }
+        return node;
+    }
+
+    /**
+     * @brief Fix sizes and rebalance bottom-up along `path`, all the way to the root since weights change everywhere
+     */
+    template <typename Node, typename Replace>
+    static void retrace(Node **path, int depth, Replace const &replace) {
+        while (depth > 0) {
+            Node *const node       = path[--depth];
+            Node *const old_parent = node->parent;
+
+            update(node);
+            if (Node *const subtree = rebalance(node); subtree != node) {
+                replace(old_parent, node, subtree);
+            }
+        }
+    }
+};
+
+/**
+ * @brief Red-black balance: no red node has a red child, every path down to a leaf crosses as many black nodes
+ *
+ * Trees may get twice as deep as perfectly balanced ones, in exchange an insertion rotates at most twice and an
+ * erasure at most three times, the rest of the fixing being recoloring.
+ *
+ * @note nodes keep no black height, `join` walks a spine to measure it, so split and the set operations take an
+ * extra log factor over the other policies
+ */
+struct RedBlackBalance : BinaryTreeBalance<RedBlackBalance> {
+    static constexpr int MAX_HEIGHT = 130;  // red-black height stays below 2 * log2(n + 1)
+
+    struct Tag {
+        bool red = true;
+    };
+
+    template <typename Node, typename Replace>
+    static void inserted(Node **path, int depth, Node *node, Replace const &replace) {
+        while (depth > 0) {
+            path[--depth]->size++;
+        }
+        while (is_red(node->parent)) {
+            Node *parent      = node->parent;
+            Node *const grand = parent->parent;
+            if (!grand) {
+                // a red root, left by a split or a join
+                parent->red = false;
+                break;
+            }
+            bool const on_left = parent == grand->left;
+            if (Node *const uncle = on_left ? grand->right : grand->left; is_red(uncle)) {
+                parent->red = false;
+                uncle->red  = false;
+                grand->red  = true;
+                node        = grand;
+                continue;
+            }
+            if (on_left && node == parent->right) {
+                parent = rotate(parent, true, replace);
+            } else if (!on_left && node == parent->left) {
+                parent = rotate(parent, false, replace);
+            }
+            parent->red = false;
+            grand->red  = true;
+            rotate(grand, !on_left, replace);
+            break;
+        }
+        if (!node->parent) {
+            node->red = false;
+        }
+    }
+
+    template <typename Node, typename Replace>
+    static void erased(Node **path, int depth, Node *node, Tag removed, Replace const &replace) {
+        for (int i = 0; i < depth; i++) {
+            path[i]->size--;
+        }
+        if (removed.red) {
+            return;
+        }
+        // `node` carries an extra black until it can absorb it or pass it up
+        Node *parent = depth > 0 ? path[depth - 1] : nullptr;
+        while (parent && !is_red(node)) {
+            bool const on_left = node == parent->left;
+            Node *sibling      = on_left ? parent->right : parent->left;
+            if (sibling->red) {
+                sibling->red = false;
+                parent->red  = true;
+                rotate(parent, on_left, replace);
+                sibling = on_left ? parent->right : parent->left;
+            }
+            Node *const inner = on_left ? sibling->left : sibling->right;
+            Node *const outer = on_left ? sibling->right : sibling->left;
+            if (!is_red(inner) && !is_red(outer)) {
+                sibling->red = true;
+                node         = parent;
+                parent       = node->parent;
+                continue;
+            }
+            if (!is_red(outer)) {
+                inner->red   = false;
+                sibling->red = true;
+                sibling      = rotate(sibling, !on_left, replace);
+            }
+            sibling->red = parent->red;
+            parent->red  = false;
+            (on_left ? sibling->right : sibling->left)->red = false;
+            rotate(parent, on_left, replace);
+            return;
+        }
+        if (node) {
+            node->red = false;
+        }
+    }
+
+    /**
+     * @brief In O(log n): `mid` goes down the spine of the tree with the larger black height to a black node
+     * matching the other tree, red-red pairs are rotated away on the way up
+     *
+     * @note the parent of the returned root is left for the caller to set
+     */
+    template <typename Node>
+    static Node *join(Node *left, Node *mid, Node *right) {
+        // a red root can always turn black, which only adds to the black height
+        if (left) {
+            left->red = false;
+        }
+        if (right) {
+            right->red = false;
+        }
+        int const left_height = black_height(left), right_height = black_height(right);
+        Node *const root      = left_height >= right_height ? join_right(left, mid, right, left_height - right_height)
+                                                            : join_left(left, mid, right, right_height - left_height);
+        root->red             = false;
+        return root;
+    }
+
+    /**
+     * @brief The black height, once checked against those of the children, the root may be red
+     */
+    template <typename Node>
+    static int check(Node const *node, int left, int right) {
+        bool const valid = left == right && !(node->red && (is_red(node->left) || is_red(node->right)));
+        return valid ? left + !node->red : -1;
+    }
+
+    /**
+     * @brief Color a tree built by halving: every leaf is on the last two levels, the last one red unless it is full
+     */
+    template <typename Node>
+    static void rebuilt(Node *root) {
+        auto const n = size(root);
+        int levels   = 0;
+        for (auto rest = n; rest; rest >>= 1) {
+            levels++;
+        }
+        paint(root, 0, (n & (n + 1)) == 0 ? levels : levels - 1);
+    }
+
+  private:
+    template <typename Node>
+    static bool is_red(Node const *node) {
+        return node && node->red;
+    }
+
+    template <typename Node>
+    static int black_height(Node const *node) {
+        int height = 0;
+        for (; node; node = node->left) {
+            height += !node->red;
+        }
+        return height;
+    }
+
+    /**
+     * @brief Rotate `node` to the left or to the right and hang the result where `node` was
+     *
+     * @return the new root of the subtree
+     */
+    template <typename Node, typename Replace>
+    static Node *rotate(Node *node, bool to_left, Replace const &replace) {
+        Node *const parent  = node->parent;
+        Node *const subtree = to_left ? left_rotate(node) : right_rotate(node);
+        replace(parent, node, subtree);
+        return subtree;
+    }
+
+    /**
+     * @param excess black height of `left` minus that of `right`, never negative
+     */
+    template <typename Node>
+    static Node *join_right(Node *left, Node *mid, Node *right, int excess) {
+        if (excess == 0 && !is_red(left)) {
+            mid->red = true;
+            return link(left, mid, right);
+        }
+        left->right         = join_right(left->right, mid, right, excess - !left->red);
+        left->right->parent = left;
+        update(left);
+        if (!left->red && is_red(left->right) && is_red(left->right->right)) {
+            left->right->right->red = false;
+            return left_rotate(left);
+        }
+        return left;
+    }
+
+    template <typename Node>
+    static Node *join_left(Node *left, Node *mid, Node *right, int excess) {
+        if (excess == 0 && !is_red(right)) {
+            mid->red = true;
+            return link(left, mid, right);
+        }
+        right->left         = join_left(left, mid, right->left, excess - !right->red);
+        right->left->parent = right;
+        update(right);
+        if (!right->red && is_red(right->left) && is_red(right->left->left)) {
+            right->left->left->red = false;
+            return right_rotate(right);
+        }
+        return right;
+    }
+
+    template <typename Node>
+    static void paint(Node *node, int depth, int red_depth) {
+        if (node) {
+            node->red = depth == red_depth;
+            paint(node->left, depth + 1, red_depth);
+            paint(node->right, depth + 1, red_depth);
+        }
+    }
+};
@@ -1,8 +1,14 @@
 #pragma once
 
 #include "SkipList.h"
+#include "thread_pool.h"
+#include <algorithm>
 #include <chrono>
 #include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 extern std::vector<int> random_input;
@@ -56,6 +62,280 @@ Duration measure_findbypos(T &testMap) {
     return find_duration / testMap.size();
 }
 
+/**
+ * @brief Lookups at `samples` positions spread over the map, for engines whose lookup by position is O(pos)
+ */
+template <typename T>
+Duration measure_sampled_findbypos(T &testMap, size_t samples) {
+    size_t const size = testMap.size();
+    size_t const step = std::max<size_t>(size / samples, 1);
+    size_t count      = 0;
+    auto start_find   = std::chrono::high_resolution_clock::now();
+    for (size_t pos = 1; pos <= size; pos += step, count++) {
+        volatile auto it = testMap.findbypos(pos);
+    }
+    auto end_find = std::chrono::high_resolution_clock::now();
+
+    Duration find_duration = end_find - start_find;
+    return count ? find_duration / count : find_duration;
+}
+
+template <typename T>
+Duration measure_rank(T &testMap) {
+    auto start_rank = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < testMap.size(); ++i) {
+        volatile auto rank = testMap.rank(i);
+    }
+    auto end_rank = std::chrono::high_resolution_clock::now();
+
+    Duration rank_duration = end_rank - start_rank;
+    return rank_duration / testMap.size();
+}
+
+/**
+ * @brief Keys counted in windows of every start and a tenth of the map wide
+ */
+template <typename T>
+Duration measure_count_range(T &testMap) {
+    int const width  = testMap.size() / 10 + 1;
+    auto start_count = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < testMap.size(); ++i) {
+        volatile auto count = testMap.count_range(i, i + width);
+    }
+    auto end_count = std::chrono::high_resolution_clock::now();
+
+    Duration count_duration = end_count - start_count;
+    return count_duration / testMap.size();
+}
+
+/**
+ * @brief Every key looked up by each of `threads` threads at once, in wall-clock time per lookup
+ */
+template <typename T>
+Duration measure_concurrent_find(T &testMap, unsigned threads) {
+    std::vector<std::thread> workers;
+    auto start_find = std::chrono::high_resolution_clock::now();
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&testMap] {
+            for (int i = 0; i < testMap.size(); ++i) {
+                volatile bool found = testMap.contains(i);
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    auto end_find = std::chrono::high_resolution_clock::now();
+
+    Duration find_duration = end_find - start_find;
+    return find_duration / (testMap.size() * threads);
+}
+
+/**
+ * @brief The input split into `threads` interleaved slices inserted at once, in wall-clock time per insertion
+ */
+template <typename T>
+Duration measure_concurrent_insert(T &testMap, std::vector<int> const &input, unsigned threads) {
+    std::vector<std::thread> workers;
+    auto start_insert = std::chrono::high_resolution_clock::now();
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&testMap, &input, t, threads] {
+            for (size_t i = t; i < input.size(); i += threads) {
+                testMap.insert({input[i], input[i]});
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    auto end_insert = std::chrono::high_resolution_clock::now();
+
+    Duration insert_duration = end_insert - start_insert;
+    return insert_duration / testMap.size();
+}
+
+struct BulkDurations {
+    Duration build, find_many, findbypos_many, to_vector;
+};
+
+/**
+ * @brief The parallel bulk operations on `pool` over the sorted input, in wall-clock time per element
+ */
+template <typename T>
+BulkDurations measure_bulk(std::vector<int> const &input, ThreadPool &pool) {
+    std::vector<std::pair<int, int>> pairs;
+    std::vector<int> positions;
+    for (auto const &i : input) {
+        pairs.emplace_back(i, i);
+        positions.push_back(positions.size() + 1);
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    T testMap;
+    BulkDurations durations;
+    auto start = std::chrono::high_resolution_clock::now();
+    testMap.build_from_sorted(pairs.begin(), pairs.end(), pool);
+    auto end        = std::chrono::high_resolution_clock::now();
+    durations.build = (end - start) / input.size();
+
+    start               = std::chrono::high_resolution_clock::now();
+    auto found_many     = testMap.find_many(input, pool);
+    end                 = std::chrono::high_resolution_clock::now();
+    durations.find_many = (end - start) / input.size();
+
+    start                    = std::chrono::high_resolution_clock::now();
+    auto positioned          = testMap.findbypos_many({positions.begin(), positions.end()}, pool);
+    end                      = std::chrono::high_resolution_clock::now();
+    durations.findbypos_many = (end - start) / input.size();
+
+    start               = std::chrono::high_resolution_clock::now();
+    auto const exported = testMap.to_vector(pool);
+    end                 = std::chrono::high_resolution_clock::now();
+    durations.to_vector = (end - start) / input.size();
+
+    // every result holds each value once, they must sum alike
+    long long by_key = 0, by_pos = 0, by_export = 0;
+    for (size_t i = 0; i < input.size(); i++) {
+        by_key    += found_many[i]->second;
+        by_pos    += positioned[i]->second;
+        by_export += exported[i].second;
+    }
+    if (by_key != by_pos || by_key != by_export) {
+        throw std::logic_error("bulk lookups and export disagree");
+    }
+    return durations;
+}
+
+inline void print_bulk_time(unsigned threads, BulkDurations const &bulk, unsigned iteration_time) {
+    std::cout << "Bulk operations with " << threads << " threads (wall clock per element): build "
+              << bulk.build.count() / iteration_time << " ns, find_many " << bulk.find_many.count() / iteration_time
+              << " ns, findbypos_many " << bulk.findbypos_many.count() / iteration_time << " ns, to_vector "
+              << bulk.to_vector.count() / iteration_time << " ns" << std::endl;
+}
+
+struct BatchDurations {
+    Duration find, find_batch, findbypos, findbypos_batch;
+};
+
+/**
+ * @brief Lookups by key and by position in the order of `keys`, one at a time then in one batch, per lookup
+ *
+ * @param keys a permutation of the keys in the map, [0, size), its values shifted by one are the positions
+ */
+template <typename T>
+BatchDurations measure_batch(T &testMap, std::vector<int> const &keys) {
+    using Position = std::conditional_t<std::is_same_v<T, SkipList<int, int>>, int, size_t>;
+    std::vector<Position> positions(keys.begin(), keys.end());
+    for (auto &pos : positions) {
+        pos++;
+    }
+
+    // the values found one at a time and in a batch, summed so that neither side can be optimized away
+    long long single_key = 0, batch_key = 0, single_pos = 0, batch_pos = 0;
+    BatchDurations durations;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto const &key : keys) {
+        single_key += testMap.find(key)->second;
+    }
+    auto end       = std::chrono::high_resolution_clock::now();
+    durations.find = (end - start) / keys.size();
+
+    start                = std::chrono::high_resolution_clock::now();
+    auto by_key          = testMap.find_batch(keys);
+    end                  = std::chrono::high_resolution_clock::now();
+    durations.find_batch = (end - start) / keys.size();
+
+    start = std::chrono::high_resolution_clock::now();
+    for (auto const &pos : positions) {
+        single_pos += testMap.findbypos(pos)->second;
+    }
+    end                 = std::chrono::high_resolution_clock::now();
+    durations.findbypos = (end - start) / keys.size();
+
+    start                     = std::chrono::high_resolution_clock::now();
+    auto by_pos               = testMap.findbypos_batch(positions);
+    end                       = std::chrono::high_resolution_clock::now();
+    durations.findbypos_batch = (end - start) / keys.size();
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        batch_key += by_key[i]->second;
+        batch_pos += by_pos[i]->second;
+    }
+    if (single_key != batch_key || single_pos != batch_pos) {
+        throw std::logic_error("batched lookups disagree with single ones");
+    }
+    return durations;
+}
+
+inline void print_batch_time(BatchDurations const &batch, unsigned iteration_time) {
+    std::cout << "Lookup by key time (per operation): " << batch.find.count() / iteration_time << " ns, batched "
+              << batch.find_batch.count() / iteration_time << " ns" << std::endl;
+    std::cout << "Lookup by position time (per operation): " << batch.findbypos.count() / iteration_time
+              << " ns, batched " << batch.findbypos_batch.count() / iteration_time << " ns" << std::endl;
+}
+
+struct LatencyPercentiles {
+    Duration p50, p99, p999, max;
+};
+
+struct LatencyDurations {
+    LatencyPercentiles insert, find, findbypos;
+};
+
+/**
+ * @brief Percentiles of `samples`, which are sorted in place
+ */
+inline LatencyPercentiles percentiles(std::vector<Duration> &samples) {
+    std::sort(samples.begin(), samples.end());
+    auto const at = [&samples](double rank) { return samples[static_cast<size_t>(rank * (samples.size() - 1))]; };
+    return {at(0.5), at(0.99), at(0.999), samples.back()};
+}
+
+/**
+ * @brief Latency distribution of single insertions, lookups by key and lookups by position, each timed on its own
+ *
+ * @param keys inserted in this order then looked up in this order, a permutation of [0, size) whose values shifted by
+ * one are the positions
+ * @note every sample includes the cost of reading the clock, tens of ns
+ */
+template <typename T>
+LatencyDurations measure_latency(T &testMap, std::vector<int> const &keys) {
+    std::vector<Duration> samples(keys.size());
+    LatencyDurations latency;
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto const start = std::chrono::high_resolution_clock::now();
+        testMap.insert({keys[i], keys[i]});
+        samples[i] = std::chrono::high_resolution_clock::now() - start;
+    }
+    latency.insert = percentiles(samples);
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto const start    = std::chrono::high_resolution_clock::now();
+        volatile auto found = &testMap.find(keys[i])->second;
+        samples[i]          = std::chrono::high_resolution_clock::now() - start;
+    }
+    latency.find = percentiles(samples);
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto const start    = std::chrono::high_resolution_clock::now();
+        volatile auto found = &testMap.findbypos(keys[i] + 1)->second;
+        samples[i]          = std::chrono::high_resolution_clock::now() - start;
+    }
+    latency.findbypos = percentiles(samples);
+    return latency;
+}
+
+inline void print_latency(LatencyDurations const &latency) {
+    auto const print = [](char const *name, LatencyPercentiles const &percentiles) {
+        std::cout << name << " latency: p50 " << percentiles.p50.count() << " ns, p99 " << percentiles.p99.count()
+                  << " ns, p99.9 " << percentiles.p999.count() << " ns, max " << percentiles.max.count() << " ns"
+                  << std::endl;
+    };
+    print("Insertion", latency.insert);
+    print("Lookup by key", latency.find);
+    print("Lookup by position", latency.findbypos);
+}
+
 template <typename T>
 Duration measure_erase(T &testMap) {
     auto start_erase = std::chrono::high_resolution_clock::now();
@@ -72,11 +352,20 @@ inline void print_time(
     Duration const &insert, Duration const &find, Duration const &findbypos, Duration const &erase,
     unsigned iteration_time
 ) {
-    std::cout << "Insertion time (per operation): " << insert.count() / iteration_time << " ns" << std::endl;
+    if (insert != INVALID_DURATION) {
+        std::cout << "Insertion time (per operation): " << insert.count() / iteration_time << " ns" << std::endl;
+    }
     std::cout << "Lookup by key time (per operation): " << find.count() / iteration_time << " ns" << std::endl;
     if (findbypos != INVALID_DURATION) {
         std::cout << "Lookup by position time (per operation): " << findbypos.count() / iteration_time << " ns"
                   << std::endl;
     }
-    std::cout << "Erase time (per operation): " << erase.count() / iteration_time << " ns" << std::endl;
+    if (erase != INVALID_DURATION) {
+        std::cout << "Erase time (per operation): " << erase.count() / iteration_time << " ns" << std::endl;
+    }
+}
+
+inline void print_rank_time(Duration const &rank, Duration const &count_range, unsigned iteration_time) {
+    std::cout << "Rank by key time (per operation): " << rank.count() / iteration_time << " ns" << std::endl;
+    std::cout << "Count in range time (per operation): " << count_range.count() / iteration_time << " ns" << std::endl;
 }
@@ -0,0 +1,605 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <optional>
+#include <utility>
+
+#include "arena.h"
+
+/**
+ * @brief Order statistic B+ tree
+ *
+ * Leaves hold up to `LeafCapacity` sorted pairs and are chained for iteration, inner nodes hold separators and the
+ * size of every child subtree. Lookups by key or by position touch one wide node per level instead of one small node
+ * per comparison, and the bookkeeping is a few bytes per element rather than a few pointers.
+ */
+template <
+    typename K, typename V, typename Compare = std::less<K>, typename Allocator = std::allocator<std::pair<const K, V>>,
+    int LeafCapacity = 64, int InnerCapacity = 64>
+class BTreeOrderStatistic {
+  public:
+    static constexpr int BASE_INDEX = 1;   // the base index of `findbypos`
+    static constexpr int MAX_DEPTH  = 64;  // inner nodes are at least half full, so this covers any 64-bit size
+
+    static_assert(LeafCapacity >= 4 && InnerCapacity >= 4, "nodes must hold at least 4 entries");
+
+    using key_type       = K;
+    using value_type     = V;
+    using pair_type      = std::pair<key_type, value_type>;
+    using size_type      = size_t;
+    using key_compare    = Compare;
+    using allocator_type = Allocator;
+
+  private:
+    /**
+     * @brief Uninitialized storage for up to N objects, of which the owner tracks how many are alive
+     */
+    template <typename T, int N>
+    class Slots {
+      public:
+        T *data() { return std::launder(reinterpret_cast<T *>(m_raw)); }
+        T const *data() const { return std::launder(reinterpret_cast<T const *>(m_raw)); }
+        T &operator[](int i) { return data()[i]; }
+        T const &operator[](int i) const { return data()[i]; }
+
+        template <typename... Args>
+        void construct(int i, Args &&...args) {
+            new (data() + i) T(std::forward<Args>(args)...);
+        }
+        void destroy(int i) { data()[i].~T(); }
+        void destroy_all(int n) { std::destroy(data(), data() + n); }
+
+        /**
+         * @brief Insert at `pos` among `n` live objects, shifting the ones after it right
+         */
+        template <typename U>
+        void insert(int n, int pos, U &&value) {
+            if (pos == n) {
+                construct(n, std::forward<U>(value));
+                return;
+            }
+            construct(n, std::move(data()[n - 1]));
+            std::move_backward(data() + pos, data() + n - 1, data() + n);
+            data()[pos] = std::forward<U>(value);
+        }
+
+        /**
+         * @brief Erase at `pos` among `n` live objects, shifting the ones after it left
+         */
+        void erase(int n, int pos) {
+            std::move(data() + pos + 1, data() + n, data() + pos);
+            destroy(n - 1);
+        }
+
+        /**
+         * @brief Move-construct `n` objects starting at `from` into `to`, which must be free, then destroy them here
+         */
+        template <int M>
+        void transfer(int from, int n, Slots<T, M> &other, int to) {
+            std::uninitialized_move(data() + from, data() + from + n, other.data() + to);
+            std::destroy(data() + from, data() + from + n);
+        }
+
+      private:
+        alignas(T) unsigned char m_raw[sizeof(T) * N];
+    };
+
+    struct NodeBase {
+        bool is_leaf;
+        int count;  // pairs in a leaf, children in an inner node
+    };
+
+    struct Leaf : NodeBase {
+        Leaf *prev = nullptr, *next = nullptr;
+        Slots<pair_type, LeafCapacity + 1> pairs;  // one spare slot, overflow is split right after the insertion
+
+        Leaf() : NodeBase{true, 0} {}
+    };
+
+    struct Inner : NodeBase {
+        Slots<key_type, InnerCapacity> keys;  // keys[i] separates children[i] from children[i + 1]
+        NodeBase *children[InnerCapacity + 1];
+        size_type counts[InnerCapacity + 1];  // number of pairs below each child
+
+        Inner() : NodeBase{false, 0} {}
+    };
+
+    static constexpr int MIN_LEAF  = LeafCapacity / 2;
+    static constexpr int MIN_INNER = InnerCapacity / 2;
+
+  public:
+    class iterator {
+      public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = pair_type;
+        using difference_type   = ptrdiff_t;
+        using pointer           = value_type *;
+        using reference         = value_type &;
+
+      public:
+        iterator(Leaf *leaf = nullptr, int index = 0) : m_leaf(leaf), m_index(index) {}
+
+        bool operator==(const iterator &other) const { return m_leaf == other.m_leaf && m_index == other.m_index; }
+        bool operator!=(const iterator &other) const { return !(*this == other); }
+
+        iterator &operator++() {
+            if (++m_index == m_leaf->count) {
+                m_leaf  = m_leaf->next;
+                m_index = 0;
+            }
+            return *this;
+        }
+        iterator &operator--() {
+            if (m_index-- == 0) {
+                m_leaf  = m_leaf->prev;
+                m_index = m_leaf->count - 1;
+            }
+            return *this;
+        }
+        iterator operator++(int) {
+            auto temp(*this);
+            ++(*this);
+            return temp;
+        }
+        iterator operator--(int) {
+            auto temp(*this);
+            --(*this);
+            return temp;
+        }
+
+        reference operator*() const { return m_leaf->pairs[m_index]; }
+        pointer operator->() const { return &m_leaf->pairs[m_index]; }
+
+      private:
+        Leaf *m_leaf;
+        int m_index;
+    };
+
+  public:
+    explicit BTreeOrderStatistic(Compare const &cmp = Compare(), Allocator const &alloc = Allocator())
+        : m_alloc(alloc), m_cmp(cmp) {}
+    explicit BTreeOrderStatistic(Allocator const &alloc) : BTreeOrderStatistic(Compare(), alloc) {}
+    BTreeOrderStatistic(BTreeOrderStatistic const &)            = delete;
+    BTreeOrderStatistic &operator=(BTreeOrderStatistic const &) = delete;
+    ~BTreeOrderStatistic() { clear(); }
+
+    void clear() {
+        if (m_root && !can_abandon_nodes<K, V>(m_alloc)) {
+            free(m_root);
+        }
+        m_root  = nullptr;
+        m_first = m_last = nullptr;
+        m_size           = 0;
+    }
+
+    iterator begin() const { return iterator(m_first, 0); }
+    iterator last() const { return m_last ? iterator(m_last, m_last->count - 1) : end(); }
+    iterator end() const { return iterator(nullptr, 0); }
+    size_type size() const { return m_size; }
+    key_compare key_comp() const { return m_cmp; }
+    allocator_type get_allocator() const { return m_alloc; }
+
+    void insert(pair_type const &p) { insert(p.first, p.second); }
+    void insert(key_type const &key, value_type const &value) {
+        bool inserted       = false;
+        iterator const itor = emplace_key(key, value, inserted);
+        if (!inserted) {
+            itor->second = value;
+        }
+    }
+
+    value_type &operator[](key_type const &key) {
+        bool inserted = false;
+        return emplace_key(key, value_type(), inserted)->second;
+    }
+
+    iterator find(key_type const &key) const {
+        if (!m_root) {
+            return end();
+        }
+        NodeBase *node = m_root;
+        while (!node->is_leaf) {
+            Inner *const inner = static_cast<Inner *>(node);
+            node               = inner->children[child_index(inner, key)];
+        }
+        Leaf *const leaf = static_cast<Leaf *>(node);
+        int const index  = leaf_index(leaf, key);
+        if (index < leaf->count && !m_cmp(key, leaf->pairs[index].first)) {
+            return iterator(leaf, index);
+        }
+        return end();
+    }
+
+    /**
+     * @brief Find the pair by position
+     *
+     * @param pos position of the pair to be found
+     * @note base index decided by `BASE_INDEX`
+     */
+    iterator findbypos(size_type pos) const {
+        if (pos < BASE_INDEX || pos >= m_size + BASE_INDEX) {
+            return end();
+        }
+        pos -= BASE_INDEX;
+        NodeBase *node = m_root;
+        while (!node->is_leaf) {
+            Inner *const inner = static_cast<Inner *>(node);
+            int child          = 0;
+            while (pos >= inner->counts[child]) {
+                pos -= inner->counts[child++];
+            }
+            node = inner->children[child];
+        }
+        return iterator(static_cast<Leaf *>(node), static_cast<int>(pos));
+    }
+
+    /**
+     * @return the number of pairs erased, 0 or 1
+     */
+    size_type erase(key_type const &key) {
+        if (!m_root) {
+            return 0;
+        }
+        Inner *path[MAX_DEPTH];
+        int slots[MAX_DEPTH];
+        int depth        = 0;
+        Leaf *const leaf = descend(key, path, slots, depth);
+        int const index  = leaf_index(leaf, key);
+        if (index == leaf->count || m_cmp(key, leaf->pairs[index].first)) {
+            return 0;
+        }
+
+        leaf->pairs.erase(leaf->count, index);
+        leaf->count--;
+        m_size--;
+        for (int d = 0; d < depth; d++) {
+            path[d]->counts[slots[d]]--;
+        }
+
+        // refill underflowing nodes bottom-up, a merge may leave the parent short in turn
+        NodeBase *node = leaf;
+        for (int d = depth - 1; d >= 0 && node->count < min_count(node); d--) {
+            fix_underflow(path[d], slots[d]);
+            node = path[d];
+        }
+
+        if (!m_root->is_leaf && m_root->count == 1) {
+            Inner *const old_root = static_cast<Inner *>(m_root);
+            m_root                = old_root->children[0];
+            delete_node(old_root);
+        } else if (m_root->is_leaf && m_root->count == 0) {
+            delete_node(static_cast<Leaf *>(m_root));
+            m_root  = nullptr;
+            m_first = m_last = nullptr;
+        }
+        return 1;
+    }
+
+  private:
+    using leaf_allocator  = typename std::allocator_traits<Allocator>::template rebind_alloc<Leaf>;
+    using inner_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Inner>;
+
+    Allocator m_alloc;
+    Compare m_cmp;
+    NodeBase *m_root = nullptr;
+    Leaf *m_first    = nullptr;
+    Leaf *m_last     = nullptr;
+    size_type m_size = 0;
+
+    /* node allocation */
+
+    Leaf *new_leaf() {
+        leaf_allocator alloc(m_alloc);
+        Leaf *const leaf = std::allocator_traits<leaf_allocator>::allocate(alloc, 1);
+        return new (leaf) Leaf();
+    }
+
+    Inner *new_inner() {
+        inner_allocator alloc(m_alloc);
+        Inner *const inner = std::allocator_traits<inner_allocator>::allocate(alloc, 1);
+        return new (inner) Inner();
+    }
+
+    void delete_node(Leaf *leaf) {
+        leaf_allocator alloc(m_alloc);
+        leaf->pairs.destroy_all(leaf->count);
+        leaf->~Leaf();
+        std::allocator_traits<leaf_allocator>::deallocate(alloc, leaf, 1);
+    }
+
+    void delete_node(Inner *inner) {
+        inner_allocator alloc(m_alloc);
+        inner->keys.destroy_all(inner->count - 1);
+        inner->~Inner();
+        std::allocator_traits<inner_allocator>::deallocate(alloc, inner, 1);
+    }
+
+    void free(NodeBase *node) {
+        if (node->is_leaf) {
+            delete_node(static_cast<Leaf *>(node));
+            return;
+        }
+        Inner *const inner = static_cast<Inner *>(node);
+        for (int i = 0; i < inner->count; i++) {
+            free(inner->children[i]);
+        }
+        delete_node(inner);
+    }
+
+    /* searching */
+
+    /**
+     * @brief Index of the child of `inner` whose range holds `key`
+     */
+    int child_index(Inner const *inner, key_type const &key) const {
+        auto const *keys = inner->keys.data();
+        return std::upper_bound(keys, keys + inner->count - 1, key, m_cmp) - keys;
+    }
+
+    /**
+     * @brief Index of the first pair of `leaf` not before `key`
+     */
+    int leaf_index(Leaf const *leaf, key_type const &key) const {
+        auto const *pairs = leaf->pairs.data();
+        auto const before = [this](pair_type const &p, key_type const &k) { return m_cmp(p.first, k); };
+        return std::lower_bound(pairs, pairs + leaf->count, key, before) - pairs;
+    }
+
+    /**
+     * @brief Walk down to the leaf whose range holds `key`, recording the inner nodes and child slots taken
+     */
+    Leaf *descend(key_type const &key, Inner **path, int *slots, int &depth) const {
+        NodeBase *node = m_root;
+        depth          = 0;
+        while (!node->is_leaf) {
+            Inner *const inner = static_cast<Inner *>(node);
+            int const child    = child_index(inner, key);
+            path[depth]        = inner;
+            slots[depth++]     = child;
+            node               = inner->children[child];
+        }
+        return static_cast<Leaf *>(node);
+    }
+
+    static size_type subtree_size(NodeBase const *node) {
+        if (node->is_leaf) {
+            return node->count;
+        }
+        Inner const *const inner = static_cast<Inner const *>(node);
+        return std::accumulate(inner->counts, inner->counts + inner->count, size_type(0));
+    }
+
+    static int min_count(NodeBase const *node) { return node->is_leaf ? MIN_LEAF : MIN_INNER; }
+
+    /* insertion */
+
+    /**
+     * @brief Find `key`, inserting it with `value` if absent
+     *
+     * @param inserted set to whether `key` was absent
+     */
+    iterator emplace_key(key_type const &key, value_type const &value, bool &inserted) {
+        if (!m_root) {
+            Leaf *const leaf = new_leaf();
+            m_root = m_first = m_last = leaf;
+        }
+
+        Inner *path[MAX_DEPTH];
+        int slots[MAX_DEPTH];
+        int depth        = 0;
+        Leaf *const leaf = descend(key, path, slots, depth);
+        int const index  = leaf_index(leaf, key);
+        if (index < leaf->count && !m_cmp(key, leaf->pairs[index].first)) {
+            inserted = false;
+            return iterator(leaf, index);
+        }
+
+        inserted = true;
+        leaf->pairs.insert(leaf->count, index, pair_type(key, value));
+        leaf->count++;
+        m_size++;
+
+        // split overflowing nodes bottom-up, handing each new right sibling and its separator to the parent
+        std::optional<key_type> separator;
+        NodeBase *right = nullptr;
+        iterator const result =
+            leaf->count > LeafCapacity ? split_leaf(leaf, index, separator, right) : iterator(leaf, index);
+        for (int d = depth - 1; d >= 0; d--) {
+            Inner *const parent = path[d];
+            int const slot      = slots[d];
+            if (!right) {
+                parent->counts[slot]++;
+                continue;
+            }
+            parent->counts[slot] = subtree_size(parent->children[slot]);
+            insert_child(parent, slot + 1, std::move(*separator), right);
+            separator.reset();
+            right = parent->count > InnerCapacity ? split_inner(parent, separator) : nullptr;
+        }
+        if (right) {
+            Inner *const new_root = new_inner();
+            new_root->keys.construct(0, std::move(*separator));
+            new_root->children[0] = m_root;
+            new_root->children[1] = right;
+            new_root->counts[0]   = subtree_size(m_root);
+            new_root->counts[1]   = subtree_size(right);
+            new_root->count       = 2;
+            m_root                = new_root;
+        }
+        return result;
+    }
+
+    /**
+     * @brief Move the upper half of an overflowing leaf into a new right sibling
+     *
+     * @param index a position in `leaf` before the split
+     * @return where the pair at `index` ended up
+     */
+    iterator split_leaf(Leaf *leaf, int index, std::optional<key_type> &separator, NodeBase *&right_out) {
+        Leaf *const right = new_leaf();
+        int const keep    = leaf->count / 2;
+        leaf->pairs.transfer(keep, leaf->count - keep, right->pairs, 0);
+        right->count = leaf->count - keep;
+        leaf->count  = keep;
+
+        right->prev = leaf;
+        right->next = leaf->next;
+        if (leaf->next) {
+            leaf->next->prev = right;
+        } else {
+            m_last = right;
+        }
+        leaf->next = right;
+
+        separator.emplace(right->pairs[0].first);
+        right_out = right;
+        return index < keep ? iterator(leaf, index) : iterator(right, index - keep);
+    }
+
+    /**
+     * @brief Move the upper half of an overflowing inner node into a new right sibling
+     *
+     * @param separator set to the key between the two halves, which moves up to the parent
+     */
+    Inner *split_inner(Inner *inner, std::optional<key_type> &separator) {
+        Inner *const right = new_inner();
+        int const total    = inner->count;
+        int const keep     = total / 2;
+
+        separator.emplace(std::move(inner->keys[keep - 1]));
+        inner->keys.destroy(keep - 1);
+        inner->keys.transfer(keep, total - 1 - keep, right->keys, 0);
+        std::copy(inner->children + keep, inner->children + total, right->children);
+        std::copy(inner->counts + keep, inner->counts + total, right->counts);
+        right->count = total - keep;
+        inner->count = keep;
+        return right;
+    }
+
+    /**
+     * @brief Insert `child` at `slot` of `inner`, preceded by `separator`
+     */
+    void insert_child(Inner *inner, int slot, key_type &&separator, NodeBase *child) {
+        inner->keys.insert(inner->count - 1, slot - 1, std::move(separator));
+        std::copy_backward(inner->children + slot, inner->children + inner->count, inner->children + inner->count + 1);
+        std::copy_backward(inner->counts + slot, inner->counts + inner->count, inner->counts + inner->count + 1);
+        inner->children[slot] = child;
+        inner->counts[slot]   = subtree_size(child);
+        inner->count++;
+    }
+
+    /* erasure */
+
+    /**
+     * @brief Refill the child at `slot` of `parent` from a sibling, or merge it with one
+     */
+    void fix_underflow(Inner *parent, int slot) {
+        if (slot > 0 && parent->children[slot - 1]->count > min_count(parent->children[slot - 1])) {
+            borrow_from_left(parent, slot);
+        } else if (slot + 1 < parent->count &&
+                   parent->children[slot + 1]->count > min_count(parent->children[slot + 1])) {
+            borrow_from_right(parent, slot);
+        } else {
+            merge(parent, slot > 0 ? slot - 1 : slot);
+        }
+    }
+
+    void borrow_from_left(Inner *parent, int slot) {
+        NodeBase *const node = parent->children[slot];
+        NodeBase *const left = parent->children[slot - 1];
+        size_type moved      = 1;
+        if (node->is_leaf) {
+            Leaf *const to   = static_cast<Leaf *>(node);
+            Leaf *const from = static_cast<Leaf *>(left);
+            to->pairs.insert(to->count, 0, std::move(from->pairs[from->count - 1]));
+            from->pairs.destroy(from->count - 1);
+            parent->keys[slot - 1] = to->pairs[0].first;
+        } else {
+            Inner *const to   = static_cast<Inner *>(node);
+            Inner *const from = static_cast<Inner *>(left);
+            moved             = from->counts[from->count - 1];
+            to->keys.insert(to->count - 1, 0, std::move(parent->keys[slot - 1]));
+            std::copy_backward(to->children, to->children + to->count, to->children + to->count + 1);
+            std::copy_backward(to->counts, to->counts + to->count, to->counts + to->count + 1);
+            to->children[0]        = from->children[from->count - 1];
+            to->counts[0]          = moved;
+            parent->keys[slot - 1] = std::move(from->keys[from->count - 2]);
+            from->keys.destroy(from->count - 2);
+        }
+        node->count++;
+        left->count--;
+        parent->counts[slot - 1] -= moved;
+        parent->counts[slot] += moved;
+    }
+
+    void borrow_from_right(Inner *parent, int slot) {
+        NodeBase *const node  = parent->children[slot];
+        NodeBase *const right = parent->children[slot + 1];
+        size_type moved       = 1;
+        if (node->is_leaf) {
+            Leaf *const to   = static_cast<Leaf *>(node);
+            Leaf *const from = static_cast<Leaf *>(right);
+            to->pairs.construct(to->count, std::move(from->pairs[0]));
+            from->pairs.erase(from->count, 0);
+            parent->keys[slot] = from->pairs[0].first;
+        } else {
+            Inner *const to   = static_cast<Inner *>(node);
+            Inner *const from = static_cast<Inner *>(right);
+            moved             = from->counts[0];
+            to->keys.construct(to->count - 1, std::move(parent->keys[slot]));
+            to->children[to->count] = from->children[0];
+            to->counts[to->count]   = moved;
+            parent->keys[slot]      = std::move(from->keys[0]);
+            from->keys.erase(from->count - 1, 0);
+            std::copy(from->children + 1, from->children + from->count, from->children);
+            std::copy(from->counts + 1, from->counts + from->count, from->counts);
+        }
+        node->count++;
+        right->count--;
+        parent->counts[slot] += moved;
+        parent->counts[slot + 1] -= moved;
+    }
+
+    /**
+     * @brief Merge the child at `slot + 1` of `parent` into the one at `slot`
+     */
+    void merge(Inner *parent, int slot) {
+        NodeBase *const left  = parent->children[slot];
+        NodeBase *const right = parent->children[slot + 1];
+        if (left->is_leaf) {
+            Leaf *const to   = static_cast<Leaf *>(left);
+            Leaf *const from = static_cast<Leaf *>(right);
+            from->pairs.transfer(0, from->count, to->pairs, to->count);
+            to->next = from->next;
+            if (from->next) {
+                from->next->prev = to;
+            } else {
+                m_last = to;
+            }
+            to->count += from->count;
+            from->count = 0;
+            delete_node(from);
+        } else {
+            Inner *const to   = static_cast<Inner *>(left);
+            Inner *const from = static_cast<Inner *>(right);
+            to->keys.construct(to->count - 1, std::move(parent->keys[slot]));
+            from->keys.transfer(0, from->count - 1, to->keys, to->count);
+            std::copy(from->children, from->children + from->count, to->children + to->count);
+            std::copy(from->counts, from->counts + from->count, to->counts + to->count);
+            to->count += from->count;
+            from->count = 1;  // its keys are gone
+            delete_node(from);
+        }
+
+        parent->counts[slot] += parent->counts[slot + 1];
+        parent->keys.erase(parent->count - 1, slot);
+        std::copy(parent->children + slot + 2, parent->children + parent->count, parent->children + slot + 1);
+        std::copy(parent->counts + slot + 2, parent->counts + parent->count, parent->counts + slot + 1);
+        parent->count--;
+    }
+};
@@ -0,0 +1,703 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "frozen_order_statistic.h"
+
+/**
+ * @brief AVL order statistic tree whose nodes sit in one contiguous vector and link to each other by 32-bit indices
+ *
+ * A node is the pair, a left and a right index and a 32-bit size. Indices take 29 bits, the spare 3 bits of both
+ * links hold the two halves of the height, so an `int, int` entry takes 20 bytes where `AvlOrderStatisticTree` takes
+ * 48. Erasing moves the last node of the vector into the freed slot, the vector never has holes.
+ *
+ * Without parent links, which is the default, an iterator carries the ancestors it still has to visit, a few hundred
+ * bytes, instead of the node paying 4 more bytes for them; erasure then descends a second time, to find the parent of
+ * the node it moves.
+ *
+ * @tparam ParentLinks keep a parent index in each node, for small iterators
+ * @note any modification invalidates iterators, pairs move between slots
+ */
+template <
+    typename K, typename V, typename Compare = std::less<K>, typename Allocator = std::allocator<std::pair<const K, V>>,
+    bool ParentLinks = false>
+class CompactAvlOrderStatisticTree {
+  public:
+    using key_type       = K;
+    using value_type     = V;
+    using pair_type      = std::pair<key_type, value_type>;
+    using size_type      = std::uint32_t;
+    using index_type     = std::uint32_t;
+    using key_compare    = Compare;
+    using allocator_type = Allocator;
+
+    static constexpr int BASE_INDEX = 1;   // the base index of `findbypos`
+    static constexpr int MAX_HEIGHT = 48;  // AVL height stays below 1.45 * log2(n + 2), and fits the 6 bits it gets
+
+    static constexpr int INDEX_BITS      = 29;  // the rest of a link word holds half of the height
+    static constexpr int HEIGHT_LOW_BITS = 32 - INDEX_BITS;
+    static constexpr index_type NIL      = (index_type(1) << INDEX_BITS) - 1;  // no node
+    static constexpr size_type MAX_SIZE  = NIL;
+
+  private:
+    struct ParentLink {
+        index_type parent = NIL;
+    };
+    struct NoParentLink {};
+
+    struct Node : std::conditional_t<ParentLinks, ParentLink, NoParentLink> {
+        pair_type data;
+        index_type left_word  = NIL;                                // left child, high bits of the height on top
+        index_type right_word = NIL | index_type(1) << INDEX_BITS;  // right child, low bits of the height on top
+        size_type size        = 1;
+
+        /**
+         * @param args forwarded to the constructor of the pair, piecewise ones included
+         */
+        template <typename... Args>
+        explicit Node(Args &&...args) : data(std::forward<Args>(args)...) {}
+    };
+
+    /**
+     * @brief Ancestors an iterator has yet to visit, the nodes whose left subtree it is in
+     */
+    struct Ancestors {
+        index_type nodes[MAX_HEIGHT];
+        int depth = 0;
+
+        void push(index_type node) { nodes[depth++] = node; }
+        void pop() { depth--; }
+    };
+    struct NoAncestors {
+        void push(index_type) {}
+        void pop() {}
+    };
+
+  public:
+    class iterator : private std::conditional_t<ParentLinks, NoAncestors, Ancestors> {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = pair_type;
+        using difference_type   = ptrdiff_t;
+        using pointer           = value_type *;
+        using reference         = value_type &;
+
+        iterator(Node *nodes = nullptr, index_type node = NIL) : m_nodes(nodes), m_node(node) {}
+
+        bool operator==(const iterator &other) const { return m_node == other.m_node; }
+        bool operator!=(const iterator &other) const { return m_node != other.m_node; }
+        reference operator*() const { return m_nodes[m_node].data; }
+        pointer operator->() const { return &m_nodes[m_node].data; }
+
+        iterator &operator++() {
+            if (index_type node = right(m_nodes[m_node]); node != NIL) {
+                descend_left(node);
+            } else if constexpr (ParentLinks) {
+                // climb until coming up from a left subtree
+                index_type child = m_node;
+                m_node           = m_nodes[m_node].parent;
+                while (m_node != NIL && right(m_nodes[m_node]) == child) {
+                    child  = m_node;
+                    m_node = m_nodes[m_node].parent;
+                }
+            } else {
+                m_node = this->depth ? this->nodes[--this->depth] : NIL;
+            }
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+
+      private:
+        friend class CompactAvlOrderStatisticTree;
+
+        /**
+         * @brief Move to the first node of the subtree of `node`
+         */
+        void descend_left(index_type node) {
+            while (left(m_nodes[node]) != NIL) {
+                this->push(node);
+                node = left(m_nodes[node]);
+            }
+            m_node = node;
+        }
+
+        Node *m_nodes;
+        index_type m_node;
+    };
+
+    explicit CompactAvlOrderStatisticTree(Compare const &cmp = Compare(), Allocator const &alloc = Allocator())
+        : m_nodes(node_allocator(alloc)), m_cmp(cmp) {}
+    explicit CompactAvlOrderStatisticTree(Allocator const &alloc) : CompactAvlOrderStatisticTree(Compare(), alloc) {}
+    CompactAvlOrderStatisticTree(CompactAvlOrderStatisticTree const &other)            = default;
+    CompactAvlOrderStatisticTree(CompactAvlOrderStatisticTree &&other) noexcept        = default;
+    CompactAvlOrderStatisticTree &operator=(CompactAvlOrderStatisticTree const &other) = default;
+    CompactAvlOrderStatisticTree &operator=(CompactAvlOrderStatisticTree &&other)      = default;
+
+    void clear() {
+        m_nodes.clear();
+        m_root = NIL;
+    }
+
+    /**
+     * @brief Make room for `count` elements, the vector otherwise grows by reallocating, briefly holding both copies
+     */
+    void reserve(size_type count) { m_nodes.reserve(count); }
+    /**
+     * @brief Give back the slack left by growth and erasures
+     */
+    void shrink_to_fit() { m_nodes.shrink_to_fit(); }
+
+    allocator_type get_allocator() const { return allocator_type(m_nodes.get_allocator()); }
+    key_compare key_comp() const { return m_cmp; }
+    size_type size() const { return static_cast<size_type>(m_nodes.size()); }
+
+    iterator begin() const {
+        iterator itor(nodes());
+        if (m_root != NIL) {
+            itor.descend_left(m_root);
+        }
+        return itor;
+    }
+    iterator last() const {
+        index_type node = m_root;
+        while (node != NIL && right(at(node)) != NIL) {
+            node = right(at(node));
+        }
+        return iterator(nodes(), node);
+    }
+    iterator end() const { return iterator(nodes()); }
+
+    /**
+     * @brief Insert the pair, or update the value if the key already exists
+     */
+    void insert(pair_type const &p) { insert(p.first, p.second); }
+    void insert(key_type const &key, value_type const &value) {
+        if (auto const [node, inserted] = try_emplace_node(nullptr, key, value); !inserted) {
+            at(node).data.second = value;
+        }
+    }
+
+    /**
+     * @brief Insert a value built in place from `args` if `key` is absent, leave the map untouched otherwise
+     *
+     * @return the element holding `key`, and whether it was inserted
+     */
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(key_type const &key, Args &&...args) {
+        iterator itor;
+        bool const inserted = try_emplace_node(&itor, key, std::forward<Args>(args)...).second;
+        return {itor, inserted};
+    }
+
+    /**
+     * @brief Insert the pair, or assign `value` to the existing element, forwarding it either way
+     *
+     * @return the element holding `key`, and whether it was inserted
+     */
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(key_type const &key, M &&value) {
+        iterator itor;
+        auto const [node, inserted] = try_emplace_node(&itor, key, std::forward<M>(value));
+        if (!inserted) {
+            at(node).data.second = std::forward<M>(value);
+        }
+        return {itor, inserted};
+    }
+
+    value_type &operator[](key_type const &key) { return at(try_emplace_node(nullptr, key).first).data.second; }
+
+    /**
+     * @brief Replace the content with the pairs in [first, last) in O(n), laid out as a perfectly balanced tree
+     *
+     * @note the range must be sorted by `key_comp()` and free of duplicate keys
+     */
+    template <typename ForwardIt>
+    void build_from_sorted(ForwardIt first, ForwardIt last) {
+        clear();
+        auto const count = std::distance(first, last);
+        if (count > std::ptrdiff_t(MAX_SIZE)) {
+            throw std::length_error("too many elements for 29-bit indices");
+        }
+        size_type const n = static_cast<size_type>(count);
+        m_nodes.reserve(n);
+        m_root = link_balanced(first, n, NIL);
+    }
+
+    iterator find(key_type const &key) const {
+        iterator itor(nodes());
+        index_type node = m_root;
+        while (node != NIL) {
+            if (m_cmp(key, at(node).data.first)) {
+                itor.push(node);
+                node = left(at(node));
+            } else if (m_cmp(at(node).data.first, key)) {
+                node = right(at(node));
+            } else {
+                itor.m_node = node;
+                return itor;
+            }
+        }
+        return end();
+    }
+
+    /**
+     * @brief Find the pair by position
+     *
+     * @param pos position of the pair to be found
+     * @note base index decided by `BASE_INDEX`
+     */
+    iterator findbypos(size_type pos) const {
+        if (pos < BASE_INDEX || pos > size()) {
+            return end();
+        }
+        pos = pos - BASE_INDEX + 1;
+        iterator itor(nodes());
+        index_type node = m_root;
+        while (true) {
+            size_type const left_size = size_of(left(at(node)));
+            if (pos <= left_size) {
+                itor.push(node);
+                node = left(at(node));
+            } else if (pos > left_size + 1) {
+                pos -= left_size + 1;
+                node = right(at(node));
+            } else {
+                itor.m_node = node;
+                return itor;
+            }
+        }
+    }
+
+    /**
+     * @brief Number of keys before `key`, whether `key` is present or not
+     *
+     * @note a present key is found at `findbypos(rank(key) + BASE_INDEX)`
+     */
+    size_type rank(key_type const &key) const {
+        size_type rank = 0;
+        partition([this, &key](key_type const &other) { return m_cmp(other, key); }, rank);
+        return rank;
+    }
+
+    /**
+     * @brief First element whose key is not before `key`
+     */
+    iterator lower_bound(key_type const &key) const {
+        size_type rank = 0;
+        return partition([this, &key](key_type const &other) { return m_cmp(other, key); }, rank);
+    }
+
+    /**
+     * @brief First element whose key is after `key`
+     */
+    iterator upper_bound(key_type const &key) const {
+        size_type rank = 0;
+        return partition([this, &key](key_type const &other) { return !m_cmp(key, other); }, rank);
+    }
+
+    /**
+     * @brief Number of keys in [lo, hi), two descents whatever the count
+     */
+    size_type count_range(key_type const &lo, key_type const &hi) const {
+        if (!m_cmp(lo, hi)) {
+            return 0;
+        }
+        return rank(hi) - rank(lo);
+    }
+
+    /**
+     * @return whether the key was present
+     */
+    bool erase(key_type const &key) {
+        index_type path[MAX_HEIGHT];
+        int depth       = 0;
+        index_type node = m_root;
+        while (node != NIL) {
+            path[depth++] = node;
+            if (m_cmp(key, at(node).data.first)) {
+                node = left(at(node));
+            } else if (m_cmp(at(node).data.first, key)) {
+                node = right(at(node));
+            } else {
+                erase_node(path, depth);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Erase the element at `pos`
+     *
+     * @return whether `pos` was in range
+     */
+    bool erase_at(size_type pos) {
+        if (pos < BASE_INDEX || pos > size()) {
+            return false;
+        }
+        pos = pos - BASE_INDEX + 1;
+        index_type path[MAX_HEIGHT];
+        int depth       = 0;
+        index_type node = m_root;
+        while (true) {
+            path[depth++]             = node;
+            size_type const left_size = size_of(left(at(node)));
+            if (pos <= left_size) {
+                node = left(at(node));
+            } else if (pos > left_size + 1) {
+                pos -= left_size + 1;
+                node = right(at(node));
+            } else {
+                erase_node(path, depth);
+                return true;
+            }
+        }
+    }
+
+    /**
+     * @brief Immutable snapshot of the current content, for lookups by key and position on a map that rarely changes
+     */
+    FrozenOrderStatistic<K, V, Compare, Allocator> freeze() const { return {begin(), end(), m_cmp, get_allocator()}; }
+
+  private:
+    using node_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+
+    std::vector<Node, node_allocator> m_nodes;
+    Compare m_cmp;
+    index_type m_root = NIL;
+
+    /* node access */
+
+    Node *nodes() const { return const_cast<Node *>(m_nodes.data()); }
+    Node &at(index_type node) { return m_nodes[node]; }
+    Node const &at(index_type node) const { return m_nodes[node]; }
+
+    static index_type left(Node const &node) { return node.left_word & NIL; }
+    static index_type right(Node const &node) { return node.right_word & NIL; }
+    static void set_left(Node &node, index_type child) { node.left_word = (node.left_word & ~NIL) | child; }
+    static void set_right(Node &node, index_type child) { node.right_word = (node.right_word & ~NIL) | child; }
+    static int height(Node const &node) {
+        return int(node.left_word >> INDEX_BITS) << HEIGHT_LOW_BITS | int(node.right_word >> INDEX_BITS);
+    }
+    static void set_height(Node &node, int height) {
+        node.left_word  = left(node) | index_type(height >> HEIGHT_LOW_BITS) << INDEX_BITS;
+        node.right_word = right(node) | index_type(height) << INDEX_BITS;
+    }
+
+    int height_of(index_type node) const { return node != NIL ? height(at(node)) : 0; }
+    size_type size_of(index_type node) const { return node != NIL ? at(node).size : 0; }
+
+    void set_parent(index_type child, index_type parent) {
+        if constexpr (ParentLinks) {
+            if (child != NIL) {
+                at(child).parent = parent;
+            }
+        }
+    }
+
+    /**
+     * @brief Point `itor` at `target`, its ancestors taken from a descent instead of searched again
+     *
+     * @param path the first `keep` nodes of the descent, still the ancestors of `top` in that order
+     * @param top the node below them, `target` itself or an ancestor of it found again by key
+     */
+    void point(iterator &itor, index_type const *path, int keep, index_type top, index_type target) const {
+        itor.m_nodes = nodes();
+        itor.m_node  = target;
+        if constexpr (!ParentLinks) {
+            for (int i = 0; i < keep; i++) {
+                if (left(at(path[i])) == (i + 1 < keep ? path[i + 1] : top)) {
+                    itor.push(path[i]);
+                }
+            }
+            while (top != target) {
+                if (m_cmp(at(target).data.first, at(top).data.first)) {
+                    itor.push(top);
+                    top = left(at(top));
+                } else {
+                    top = right(at(top));
+                }
+            }
+        }
+    }
+
+    /* AVL low-level operations */
+
+    void update(index_type node) {
+        Node &n = at(node);
+        set_height(n, 1 + std::max(height_of(left(n)), height_of(right(n))));
+        n.size = 1 + size_of(left(n)) + size_of(right(n));
+    }
+
+    index_type right_rotate(index_type node) {
+        index_type const top = left(at(node));
+        set_left(at(node), right(at(top)));
+        set_parent(right(at(top)), node);
+        set_right(at(top), node);
+        if constexpr (ParentLinks) {
+            at(top).parent  = at(node).parent;
+            at(node).parent = top;
+        }
+        update(node);
+        update(top);
+        return top;
+    }
+
+    index_type left_rotate(index_type node) {
+        index_type const top = right(at(node));
+        set_right(at(node), left(at(top)));
+        set_parent(left(at(top)), node);
+        set_left(at(top), node);
+        if constexpr (ParentLinks) {
+            at(top).parent  = at(node).parent;
+            at(node).parent = top;
+        }
+        update(node);
+        update(top);
+        return top;
+    }
+
+    int get_balance(index_type node) const { return height_of(left(at(node))) - height_of(right(at(node))); }
+
+    /**
+     * @brief Rotate `node` back into AVL shape if its children differ in height by more than one
+     *
+     * @return the root of the subtree, `node` or the one rotated above it
+     */
+    index_type rebalance(index_type node) {
+        int const balance = get_balance(node);
+        if (balance > 1) {
+            if (get_balance(left(at(node))) < 0) {
+                set_left(at(node), left_rotate(left(at(node))));
+            }
+            return right_rotate(node);
+        }
+        if (balance < -1) {
+            if (get_balance(right(at(node))) > 0) {
+                set_right(at(node), right_rotate(right(at(node))));
+            }
+            return left_rotate(node);
+        }
+        return node;
+    }
+
+    /**
+     * @brief Hang `fresh` where `old` was below `parent`, or make it the root
+     */
+    void replace_child(index_type parent, index_type old, index_type fresh) {
+        if (parent == NIL) {
+            m_root = fresh;
+        } else if (left(at(parent)) == old) {
+            set_left(at(parent), fresh);
+        } else {
+            set_right(at(parent), fresh);
+        }
+        set_parent(fresh, parent);
+    }
+
+    /**
+     * @brief Fix heights and sizes bottom-up along `path` after its last node gained or lost a descendant
+     *
+     * @param path the nodes from the root down to the parent of the changed position
+     * @param depth number of nodes on `path`
+     * @param delta +1 after an insertion, -1 after an erasure
+     * @return the index on `path` of the highest node a rotation replaced, `depth` if nothing rotated
+     */
+    int retrace(index_type *path, int depth, int delta) {
+        int rotated = depth;
+        while (depth > 0) {
+            index_type const node   = path[--depth];
+            int const old_height    = height(at(node));
+            index_type const parent = depth ? path[depth - 1] : NIL;
+
+            update(node);
+            index_type const subtree = rebalance(node);
+            if (subtree != node) {
+                replace_child(parent, node, subtree);
+                rotated = depth;
+            }
+            if (height(at(subtree)) == old_height) {
+                break;
+            }
+        }
+        while (depth > 0) {
+            at(path[--depth]).size += delta;
+        }
+        return rotated;
+    }
+
+    /**
+     * @brief Node holding `key`, built from `args` at the end of the vector and linked if the key is absent
+     *
+     * @param found if not null, pointed at the node from the same descent
+     * @return the node, and whether it was inserted
+     */
+    template <typename KeyArg, typename... Args>
+    std::pair<index_type, bool> try_emplace_node(iterator *found, KeyArg &&key, Args &&...args) {
+        index_type path[MAX_HEIGHT];
+        int depth       = 0;
+        index_type node = m_root;
+        while (node != NIL) {
+            path[depth++] = node;
+            if (m_cmp(key, at(node).data.first)) {
+                node = left(at(node));
+            } else if (m_cmp(at(node).data.first, key)) {
+                node = right(at(node));
+            } else {
+                if (found) {
+                    point(*found, path, depth - 1, node, node);
+                }
+                return {node, false};
+            }
+        }
+        if (size() == MAX_SIZE) {
+            throw std::length_error("too many elements for 29-bit indices");
+        }
+
+        index_type const fresh = size();
+        m_nodes.emplace_back(
+            std::piecewise_construct, std::forward_as_tuple(std::forward<KeyArg>(key)),
+            std::forward_as_tuple(std::forward<Args>(args)...)
+        );
+        if (depth == 0) {
+            m_root = fresh;
+            if (found) {
+                point(*found, path, 0, fresh, fresh);
+            }
+            return {fresh, true};
+        }
+        index_type const parent = path[depth - 1];
+        if (m_cmp(at(fresh).data.first, at(parent).data.first)) {
+            set_left(at(parent), fresh);
+        } else {
+            set_right(at(parent), fresh);
+        }
+        set_parent(fresh, parent);
+        int const kept = retrace(path, depth, +1);
+        if (found) {
+            // a rotation reshaped the path from `kept` down, the fresh node is found again by key below that
+            index_type top = fresh;
+            if (kept == 0) {
+                top = m_root;
+            } else if (kept < depth) {
+                Node const &above = at(path[kept - 1]);
+                top               = m_cmp(at(fresh).data.first, above.data.first) ? left(above) : right(above);
+            }
+            point(*found, path, kept, top, fresh);
+        }
+        return {fresh, true};
+    }
+
+    /**
+     * @brief Unlink the last node of `path` and give its slot to the last node of the vector
+     *
+     * A node with two children takes the pair of its in-order successor instead, which is unlinked in its place.
+     *
+     * @param path the nodes from the root down to the one to erase
+     * @param depth number of nodes on `path`
+     */
+    void erase_node(index_type *path, int depth) {
+        index_type doomed = path[--depth];
+        if (left(at(doomed)) != NIL && right(at(doomed)) != NIL) {
+            index_type const node = doomed;
+            path[depth++]         = node;
+            doomed                = right(at(node));
+            while (left(at(doomed)) != NIL) {
+                path[depth++] = doomed;
+                doomed        = left(at(doomed));
+            }
+            at(node).data = std::move(at(doomed).data);
+        }
+        index_type const child = left(at(doomed)) != NIL ? left(at(doomed)) : right(at(doomed));
+        replace_child(depth ? path[depth - 1] : NIL, doomed, child);
+        retrace(path, depth, -1);
+        release(doomed);
+    }
+
+    /**
+     * @brief Free the slot of an unlinked node by moving the last node of the vector into it
+     */
+    void release(index_type slot) {
+        index_type const moved = size() - 1;
+        if (slot != moved) {
+            index_type parent = NIL;
+            if constexpr (ParentLinks) {
+                parent = at(moved).parent;
+            } else {
+                // keys are unique, the search for the key of `moved` passes right through its parent
+                for (index_type node = m_root; node != moved;) {
+                    parent = node;
+                    node = m_cmp(at(moved).data.first, at(node).data.first) ? left(at(node)) : right(at(node));
+                }
+            }
+            at(slot) = std::move(at(moved));
+            replace_child(parent, moved, slot);
+            set_parent(left(at(slot)), slot);
+            set_parent(right(at(slot)), slot);
+        }
+        m_nodes.pop_back();
+    }
+
+    /**
+     * @brief Balanced subtree of the next `count` pairs from `first`, built in order
+     */
+    template <typename ForwardIt>
+    index_type link_balanced(ForwardIt &first, size_type count, index_type parent) {
+        if (count == 0) {
+            return NIL;
+        }
+        size_type const left_count = count / 2;
+        index_type const left_tree = link_balanced(first, left_count, NIL);
+        index_type const node      = size();
+        m_nodes.emplace_back(first->first, first->second);
+        ++first;
+        set_left(at(node), left_tree);
+        set_parent(left_tree, node);
+        index_type const right_tree = link_balanced(first, count - left_count - 1, node);
+        set_right(at(node), right_tree);
+        set_parent(node, parent);
+        update(node);
+        return node;
+    }
+
+    /* searching */
+
+    /**
+     * @brief First element for which `before(key)` is false, `before` being true on a prefix of the key order
+     *
+     * @param rank set to the number of elements before it
+     */
+    template <typename Before>
+    iterator partition(Before before, size_type &rank) const {
+        iterator itor(nodes());
+        rank            = 0;
+        index_type node = m_root;
+        while (node != NIL) {
+            if (before(at(node).data.first)) {
+                rank += size_of(left(at(node))) + 1;
+                node = right(at(node));
+            } else {
+                itor.push(node);
+                itor.m_node = node;
+                node        = left(at(node));
+            }
+        }
+        if (itor.m_node != NIL) {
+            itor.pop();  // the answer itself is no ancestor left to visit
+        }
+        return itor;
+    }
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Ascending or descending key order chosen at runtime, the order behind the `bool ascend` constructor of
+ * `SkipList` and the `less`/`greater` one of `AvlOrderStatisticTree`
+ *
+ * Every comparison tests the direction, the containers default to `std::less` and take this one only when asked,
+ * see `DirectionalSkipList` and `DirectionalAvlOrderStatisticTree`.
+ */
+template <typename K>
+struct directional_less {
+    bool ascend = true;
+
+    directional_less(bool ascend = true) : ascend(ascend) {}
+    // a function pointer would silently convert to `true`
+    template <typename R, typename... Args>
+    directional_less(R (*)(Args...)) = delete;
+    bool operator()(K const &a, K const &b) const { return ascend ? a < b : b < a; }
+};
+
+/**
+ * @brief Sort `pairs` by key and keep only the last pair of every run of equal keys, as repeated inserts would
+ */
+template <typename Pair, typename Compare>
+void sort_unique_by_key(std::vector<Pair> &pairs, Compare const &cmp) {
+    auto const key_less = [&cmp](Pair const &a, Pair const &b) { return cmp(a.first, b.first); };
+    std::stable_sort(pairs.begin(), pairs.end(), key_less);
+
+    auto out = pairs.begin();
+    for (auto itor = pairs.begin(); itor != pairs.end(); ++itor) {
+        if (std::next(itor) != pairs.end() && !key_less(*itor, *std::next(itor))) {
+            continue;
+        }
+        if (out != itor) {
+            *out = std::move(*itor);
+        }
+        ++out;
+    }
+    pairs.erase(out, pairs.end());
+}
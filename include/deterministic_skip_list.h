@@ -0,0 +1,674 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+#include "frozen_order_statistic.h"
+
+/**
+ * @brief Deterministic 1-2-3 skip list, every operation bounded in the worst case rather than on average
+ *
+ * Levels are linked lists as in `SkipList`, but no height is drawn: under two consecutive nodes of a level lie 2 to 4
+ * nodes of the level below (a 2-3-4 tree threaded level by level), so a search makes at most 3 hops on each of at
+ * most log2(n) + 1 levels. Insertion splits full gaps and erasure refills minimal ones on the way down, in the same
+ * single top-down pass as the search.
+ *
+ * A node above the bottom stands for the gap under it: it keeps the largest key there and the number of elements
+ * there, its span, which `findbypos` and `rank` add up as `SkipList` does with its spans.
+ *
+ * @note insertion and erasure move pairs between neighboring nodes: any modification invalidates iterators, and
+ * references to keys and values as well, those returned by `operator[]` included
+ *
+ * @tparam SizeT type of sizes, spans and positions, as in `SkipList`
+ */
+template <
+    typename K, typename V, typename Compare = std::less<K>, typename Allocator = std::allocator<std::pair<const K, V>>,
+    typename SizeT = int>
+class DeterministicSkipList {
+  public:
+    static constexpr int BASE_INDEX = 1;   // the base index of `findbypos`
+    static constexpr int MAX_HEIGHT = 64;  // gaps hold at least 2 nodes, so this covers any size
+
+    using key_type       = K;
+    using value_type     = V;
+    using pair_type      = std::pair<key_type, value_type>;
+    using key_compare    = Compare;
+    using allocator_type = Allocator;
+    using size_type      = SizeT;
+
+    static_assert(std::is_integral_v<SizeT>, "sizes and positions must be integers");
+
+  private:
+    struct Link {
+        Link *right = nullptr;
+    };
+
+    struct Node : Link {
+        K first;
+        V second;
+
+        /**
+         * @param args forwarded to the constructor of the value, none value-initializes it
+         */
+        template <typename KeyArg, typename... Args>
+        explicit Node(KeyArg &&key, Args &&...args)
+            : first(std::forward<KeyArg>(key)), second(std::forward<Args>(args)...) {}
+    };
+
+    /**
+     * @brief Node of a level above the bottom, standing for its gap: the nodes one level lower up to the next gap
+     */
+    struct Index : Link {
+        Link *down;  // first node of the gap
+        SizeT span;  // elements under the gap
+        K key;       // largest key under the gap, left stale on the last node of a level
+
+        Index(Link *down, SizeT span, K const &key) : down(down), span(span), key(key) {}
+    };
+
+  public:
+    class iterator {
+      public:
+        iterator(Node *ptr) : m_ptr(ptr) {}
+        bool operator==(const iterator &it) const { return m_ptr == it.m_ptr; }
+        bool operator!=(const iterator &it) const { return m_ptr != it.m_ptr; }
+        Node *operator->() const { return m_ptr; }
+        Node *operator*() const { return m_ptr; }
+
+        iterator &operator++() {
+            m_ptr = static_cast<Node *>(m_ptr->right);
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+
+      private:
+        Node *m_ptr;
+    };
+
+    explicit DeterministicSkipList(Compare const &cmp = Compare(), Allocator const &alloc = Allocator())
+        : m_alloc(alloc), m_cmp(cmp) {}
+    explicit DeterministicSkipList(Allocator const &alloc) : DeterministicSkipList(Compare(), alloc) {}
+    DeterministicSkipList(DeterministicSkipList const &other)
+        : DeterministicSkipList(
+              other.m_cmp, std::allocator_traits<Allocator>::select_on_container_copy_construction(other.m_alloc)
+          ) {
+        build_from_sorted(other.begin(), other.end());
+    }
+    /**
+     * @note the moved-from list is left empty
+     */
+    DeterministicSkipList(DeterministicSkipList &&other) : m_alloc(other.m_alloc), m_cmp(other.m_cmp) { steal(other); }
+    DeterministicSkipList &operator=(DeterministicSkipList const &other) {
+        if (this != &other) {
+            m_cmp = other.m_cmp;
+            build_from_sorted(other.begin(), other.end());
+        }
+        return *this;
+    }
+    /**
+     * @note nodes are only taken over when the allocators are equal, they are copied otherwise
+     */
+    DeterministicSkipList &operator=(DeterministicSkipList &&other) {
+        if (this == &other) {
+            return *this;
+        }
+        if (m_alloc != other.m_alloc) {
+            *this = other;
+            other.clear();
+            return *this;
+        }
+        clear();
+        m_cmp = other.m_cmp;
+        steal(other);
+        return *this;
+    }
+    ~DeterministicSkipList() { clear(); }
+
+    void clear() {
+        if (m_root && !can_abandon_nodes<K, V>(m_alloc)) {
+            Link *first = m_root;
+            for (int level = m_height; level >= 0; level--) {
+                Link *const below = level ? static_cast<Index *>(first)->down : nullptr;
+                for (Link *node = first; node;) {
+                    Link *const next = node->right;
+                    if (level) {
+                        delete_index(static_cast<Index *>(node));
+                    } else {
+                        delete_node(static_cast<Node *>(node));
+                    }
+                    node = next;
+                }
+                first = below;
+            }
+        }
+        m_root   = nullptr;
+        m_first  = nullptr;
+        m_last   = nullptr;
+        m_height = 0;
+        m_size   = 0;
+    }
+
+    iterator begin() const { return iterator(m_first); }
+    iterator last() const { return iterator(m_last); }
+    iterator end() const { return iterator(nullptr); }
+    size_type size() const { return m_size; }
+    key_compare key_comp() const { return m_cmp; }
+    allocator_type get_allocator() const { return m_alloc; }
+
+    bool insert(pair_type const &p) { return insert(p.first, p.second); }
+    bool insert(K const &key, V const &value) {
+        insert_or_assign(key, value);
+        return true;
+    }
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(K const &key, Args &&...args) {
+        auto const [node, inserted] = try_emplace_node(key, std::forward<Args>(args)...);
+        return {iterator(node), inserted};
+    }
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(K const &key, M &&value) {
+        auto const [node, inserted] = try_emplace_node(key, std::forward<M>(value));
+        if (!inserted) {
+            node->second = std::forward<M>(value);
+        }
+        return {iterator(node), inserted};
+    }
+    V &operator[](K const &key) { return try_emplace_node(key).first->second; }
+    V &operator[](K &&key) { return try_emplace_node(std::move(key)).first->second; }
+
+    /**
+     * @brief Replace the content with the pairs in [first, last), gaps of 3 built bottom-up level by level
+     *
+     * @note the range must be sorted by `key_comp()` and free of duplicate keys
+     */
+    template <typename ForwardIt>
+    void build_from_sorted(ForwardIt first, ForwardIt last) {
+        clear();
+        std::vector<Link *> level;
+        for (; first != last; ++first) {
+            Node *const node = new_node(first->first, first->second);
+            if (m_last) {
+                m_last->right = node;
+            }
+            m_last = node;
+            level.push_back(node);
+        }
+        if (level.empty()) {
+            return;
+        }
+        m_first = static_cast<Node *>(level.front());
+        m_size  = static_cast<SizeT>(level.size());
+
+        do {
+            // gaps of 3 leave room for an insertion each, the last gap takes the 2 to 4 nodes left
+            std::vector<Link *> upper;
+            for (size_t i = 0; i < level.size();) {
+                size_t const width = level.size() - i <= 4 ? level.size() - i : 3;
+                SizeT span         = 0;
+                for (size_t j = i; j < i + width; j++) {
+                    span += span_of(level[j], m_height);
+                }
+                Index *const index = new_index(level[i], span, key_of(level[i + width - 1], m_height));
+                if (!upper.empty()) {
+                    upper.back()->right = index;
+                }
+                upper.push_back(index);
+                i += width;
+            }
+            level.swap(upper);
+            m_height++;
+        } while (level.size() > 1);
+        m_root = static_cast<Index *>(level.front());
+    }
+
+    iterator find(K const &key) const {
+        SizeT rank       = 0;
+        Node *const node = lower_bound_node(key, rank);
+        if (node && !m_cmp(key, node->first)) {
+            return iterator(node);
+        }
+        return end();
+    }
+
+    /**
+     * @brief Find the pair by position, through the spans
+     *
+     * @param pos position of the pair to be found, 1-based as in `SkipList`
+     */
+    iterator findbypos(SizeT pos) const {
+        if (pos > m_size) {
+            return end();
+        }
+        if (pos <= 1) {
+            return begin();
+        }
+        Link *node = m_root;
+        for (int level = m_height; level > 0; level--) {
+            Index *index = static_cast<Index *>(node);
+            while (pos > index->span) {
+                pos -= index->span;
+                index = static_cast<Index *>(index->right);
+            }
+            node = index->down;
+        }
+        for (; pos > 1; pos--) {
+            node = node->right;
+        }
+        return iterator(static_cast<Node *>(node));
+    }
+
+    /**
+     * @brief Number of keys before `key`, whether `key` is present or not
+     */
+    size_type rank(K const &key) const {
+        SizeT rank = 0;
+        lower_bound_node(key, rank);
+        return rank;
+    }
+
+    /**
+     * @brief First element whose key is not before `key`
+     */
+    iterator lower_bound(K const &key) const {
+        SizeT rank = 0;
+        return iterator(lower_bound_node(key, rank));
+    }
+
+    /**
+     * @brief First element whose key is after `key`
+     */
+    iterator upper_bound(K const &key) const {
+        SizeT rank = 0;
+        return iterator(partition([this, &key](K const &other) { return !m_cmp(key, other); }, rank));
+    }
+
+    /**
+     * @brief Number of keys in [lo, hi), two descents whatever the count
+     */
+    size_type count_range(K const &lo, K const &hi) const {
+        if (!m_cmp(lo, hi)) {
+            return 0;
+        }
+        return rank(hi) - rank(lo);
+    }
+
+    /**
+     * @brief Erase `key`, refilling every gap of 2 met on the way down so the one losing a node never drops below 2
+     *
+     * @return whether the key was present
+     */
+    bool erase(K const &key) {
+        if (!m_root) {
+            return false;
+        }
+        shrink();
+        Index *path[MAX_HEIGHT];  // path[level - 1] is the node of `level` whose gap holds `key`
+        path[m_height - 1] = m_root;
+        for (int level = m_height - 1; level > 0; level--) {
+            Index *const parent = path[level];
+            Index *prev         = nullptr;
+            Index *index        = child_for(parent, key, prev);
+            if (gap_size(index, 3) == 2) {
+                index = refill(parent, prev, index, level);
+            }
+            path[level - 1] = index;
+        }
+
+        Link *const end = gap_end(path[0]);
+        Node *prev      = nullptr;
+        Node *node      = static_cast<Node *>(path[0]->down);
+        while (node != end && m_cmp(node->first, key)) {
+            prev = node;
+            node = static_cast<Node *>(node->right);
+        }
+        if (node == end || m_cmp(key, node->first)) {
+            shrink();
+            return false;
+        }
+
+        m_size--;
+        for (int level = 0; level < m_height; level++) {
+            path[level]->span--;
+        }
+        if (node->right != end) {
+            // pull the next pair of the gap in and drop its node, the largest keys above stay the same
+            Node *const next = static_cast<Node *>(node->right);
+            node->first      = std::move(next->first);
+            node->second     = std::move(next->second);
+            node->right      = next->right;
+            if (m_last == next) {
+                m_last = node;
+            }
+            delete_node(next);
+        } else if (prev) {
+            // the largest key of every gap ending here becomes the one of `prev`
+            for (int level = 0; level < m_height; level++) {
+                if (!m_cmp(path[level]->key, key) && !m_cmp(key, path[level]->key)) {
+                    path[level]->key = prev->first;
+                }
+            }
+            prev->right = node->right;
+            if (m_last == node) {
+                m_last = prev;
+            }
+            delete_node(node);
+        } else {
+            // only the root gap may hold a single node, the list is now empty
+            delete_node(node);
+            delete_index(m_root);
+            m_root   = nullptr;
+            m_first  = nullptr;
+            m_last   = nullptr;
+            m_height = 0;
+            return true;
+        }
+        shrink();
+        return true;
+    }
+
+    /**
+     * @brief Erase the element at `pos`
+     *
+     * @return whether `pos` was in range
+     */
+    bool erase_at(SizeT pos) {
+        if (pos < 1 || pos > m_size) {
+            return false;
+        }
+        K const key = findbypos(pos)->first;
+        return erase(key);
+    }
+
+    /**
+     * @brief Immutable snapshot of the current content, for lookups by key and position on a list that rarely changes
+     */
+    FrozenOrderStatistic<K, V, Compare, Allocator> freeze() const { return {begin(), end(), m_cmp, get_allocator()}; }
+
+  private:
+    using node_allocator  = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+    using index_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Index>;
+
+    Allocator m_alloc;
+    Compare m_cmp;
+    Index *m_root  = nullptr;  // alone on the top level
+    Node *m_first  = nullptr;
+    Node *m_last   = nullptr;
+    int m_height   = 0;  // levels above the bottom
+    SizeT m_size   = 0;
+
+    /* node allocation */
+
+    template <typename... Args>
+    Node *new_node(Args &&...args) {
+        node_allocator alloc(m_alloc);
+        Node *const node = std::allocator_traits<node_allocator>::allocate(alloc, 1);
+        try {
+            return new (node) Node(std::forward<Args>(args)...);
+        } catch (...) {
+            std::allocator_traits<node_allocator>::deallocate(alloc, node, 1);
+            throw;
+        }
+    }
+
+    Index *new_index(Link *down, SizeT span, K const &key) {
+        index_allocator alloc(m_alloc);
+        Index *const index = std::allocator_traits<index_allocator>::allocate(alloc, 1);
+        try {
+            return new (index) Index(down, span, key);
+        } catch (...) {
+            std::allocator_traits<index_allocator>::deallocate(alloc, index, 1);
+            throw;
+        }
+    }
+
+    void delete_node(Node *node) {
+        node_allocator alloc(m_alloc);
+        node->~Node();
+        std::allocator_traits<node_allocator>::deallocate(alloc, node, 1);
+    }
+
+    void delete_index(Index *index) {
+        index_allocator alloc(m_alloc);
+        index->~Index();
+        std::allocator_traits<index_allocator>::deallocate(alloc, index, 1);
+    }
+
+    void steal(DeterministicSkipList &other) {
+        std::swap(m_root, other.m_root);
+        std::swap(m_first, other.m_first);
+        std::swap(m_last, other.m_last);
+        std::swap(m_height, other.m_height);
+        std::swap(m_size, other.m_size);
+    }
+
+    /* gaps */
+
+    static K const &key_of(Link const *node, int level) {
+        return level ? static_cast<Index const *>(node)->key : static_cast<Node const *>(node)->first;
+    }
+
+    static SizeT span_of(Link const *node, int level) { return level ? static_cast<Index const *>(node)->span : 1; }
+
+    /**
+     * @brief First node past the gap of `index`, one level lower
+     */
+    static Link *gap_end(Index const *index) {
+        return index->right ? static_cast<Index *>(index->right)->down : nullptr;
+    }
+
+    /**
+     * @brief Number of nodes in the gap of `index`, counted up to `limit`
+     */
+    static int gap_size(Index const *index, int limit) {
+        Link const *const end = gap_end(index);
+        int size              = 0;
+        for (Link const *node = index->down; node != end && size < limit; node = node->right) {
+            size++;
+        }
+        return size;
+    }
+
+    /**
+     * @brief Node of the gap of `parent` whose own gap holds `key`, the last one when `key` is after them all
+     *
+     * @param prev set to the node before it in the gap, nullptr for the first
+     */
+    Index *child_for(Index *parent, K const &key, Index *&prev) const {
+        Link *const end = gap_end(parent);
+        Index *index    = static_cast<Index *>(parent->down);
+        while (index->right != end && m_cmp(index->key, key)) {
+            prev  = index;
+            index = static_cast<Index *>(index->right);
+        }
+        return index;
+    }
+
+    /**
+     * @brief Split the full gap of `index`, of `level`, into two gaps of 2, the second under a new node after it
+     *
+     * @return the one of the two whose gap holds `key`
+     */
+    Index *split(Index *index, int level, K const &key) {
+        Link *const second = index->down->right;
+        Link *const third  = second->right;
+        SizeT const span   = span_of(third, level - 1) + span_of(third->right, level - 1);
+        Index *const fresh = new_index(third, span, index->key);
+        fresh->right       = index->right;
+        index->right       = fresh;
+        index->span -= span;
+        index->key = key_of(second, level - 1);
+        return m_cmp(index->key, key) ? fresh : index;
+    }
+
+    /**
+     * @brief Bring the gap of `index`, of `level` and holding 2 nodes, to 3 or more
+     *
+     * Borrow a node from a neighbor under the same `parent` when it has 3 or more, otherwise merge with it. The
+     * neighbor is the next node, or `prev` when `index` is the last of its gap.
+     *
+     * @return the node now standing for the gap `index` had
+     */
+    Index *refill(Index *parent, Index *prev, Index *index, int level) {
+        if (index->right != gap_end(parent)) {
+            Index *const next = static_cast<Index *>(index->right);
+            if (gap_size(next, 3) == 3) {
+                Link *const moved = next->down;
+                SizeT const span  = span_of(moved, level - 1);
+                next->down        = moved->right;
+                next->span -= span;
+                index->span += span;
+                index->key = key_of(moved, level - 1);
+                return index;
+            }
+            index->right = next->right;
+            index->span += next->span;
+            index->key = std::move(next->key);
+            delete_index(next);
+            return index;
+        }
+
+        if (gap_size(prev, 3) == 3) {
+            Link *before = prev->down;
+            while (before->right->right != index->down) {
+                before = before->right;
+            }
+            Link *const moved = before->right;
+            SizeT const span  = span_of(moved, level - 1);
+            index->down       = moved;
+            index->span += span;
+            prev->span -= span;
+            prev->key = key_of(before, level - 1);
+            return index;
+        }
+        prev->right = index->right;
+        prev->span += index->span;
+        prev->key = std::move(index->key);
+        delete_index(index);
+        return prev;
+    }
+
+    /**
+     * @brief Drop the top levels left with a single node
+     */
+    void shrink() {
+        while (m_height > 1 && !m_root->down->right) {
+            Index *const old_root = m_root;
+            m_root                = static_cast<Index *>(m_root->down);
+            delete_index(old_root);
+            m_height--;
+        }
+    }
+
+    /* searching */
+
+    /**
+     * @brief First node for which `before(node key)` is false, `before` being true on a prefix of the key order
+     *
+     * @param rank set to the number of nodes before the one returned, summed from the spans crossed on the way down
+     * @return the node, or nullptr when `before` holds for every key
+     */
+    template <typename Before>
+    Node *partition(Before before, SizeT &rank) const {
+        rank = 0;
+        if (!m_root) {
+            return nullptr;
+        }
+        Link *node = m_root;
+        for (int level = m_height; level > 0; level--) {
+            Index *index = static_cast<Index *>(node);
+            while (index->right && before(index->key)) {
+                rank += index->span;
+                index = static_cast<Index *>(index->right);
+            }
+            node = index->down;
+        }
+        Node *bottom = static_cast<Node *>(node);
+        while (bottom && before(bottom->first)) {
+            rank++;
+            bottom = static_cast<Node *>(bottom->right);
+        }
+        return bottom;
+    }
+
+    Node *lower_bound_node(K const &key, SizeT &rank) const {
+        return partition([this, &key](K const &other) { return m_cmp(other, key); }, rank);
+    }
+
+    /**
+     * @brief Node holding `key`, built from `args` and linked if the key is absent
+     *
+     * Every full gap met on the way down is split first, so the bottom gap receiving the node has room for it. The
+     * node is linked after the first one not before `key` and the two trade pairs, no predecessor is needed.
+     *
+     * @return the node, and whether it was inserted
+     */
+    template <typename KeyArg, typename... Args>
+    std::pair<Node *, bool> try_emplace_node(KeyArg &&key, Args &&...args) {
+        if (!m_root) {
+            Node *const node = new_node(std::forward<KeyArg>(key), std::forward<Args>(args)...);
+            m_root           = new_index(node, 1, node->first);
+            m_first          = node;
+            m_last           = node;
+            m_height         = 1;
+            m_size           = 1;
+            return {node, true};
+        }
+        if (gap_size(m_root, 4) == 4) {
+            m_root = new_index(m_root, m_root->span, m_root->key);
+            m_height++;
+        }
+
+        Index *path[MAX_HEIGHT];  // path[level - 1] is the node of `level` whose gap holds `key`
+        path[m_height - 1] = m_root;
+        for (int level = m_height - 1; level >= 0; level--) {
+            if (gap_size(path[level], 4) == 4) {
+                path[level] = split(path[level], level + 1, key);
+            }
+            if (level > 0) {
+                Index *prev     = nullptr;
+                path[level - 1] = child_for(path[level], key, prev);
+            }
+        }
+
+        Link *const end = gap_end(path[0]);
+        Node *prev      = nullptr;
+        Node *node      = static_cast<Node *>(path[0]->down);
+        while (node != end && m_cmp(node->first, key)) {
+            prev = node;
+            node = static_cast<Node *>(node->right);
+        }
+        if (node != end && !m_cmp(key, node->first)) {
+            return {node, false};
+        }
+
+        Node *const fresh = new_node(std::forward<KeyArg>(key), std::forward<Args>(args)...);
+        if (node == end) {
+            // after every key, which only the gap of the last node of its level can hold
+            prev->right = fresh;
+            m_last      = fresh;
+            node        = fresh;
+        } else {
+            fresh->right = node->right;
+            node->right  = fresh;
+            std::swap(node->first, fresh->first);
+            std::swap(node->second, fresh->second);
+            if (m_last == node) {
+                m_last = fresh;
+            }
+        }
+        m_size++;
+        for (int level = 0; level < m_height; level++) {
+            path[level]->span++;
+        }
+        return {node, true};
+    }
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Epoch-based reclamation for the lock-free readers of the concurrent containers
+ *
+ * Readers `pin()` the current epoch for the duration of an operation. A node unlinked by a writer is `retire()`d
+ * rather than freed, and is only freed once the global epoch has advanced twice past its retirement: by then every
+ * thread pinned at the time of the unlink has unpinned, so no reader can still hold a pointer to it.
+ *
+ * The epoch only advances while no thread stays pinned on an older one, so guards should be short lived. One domain
+ * serves the whole process, each thread claims a record in it on first use and gives it back on exit.
+ */
+class EpochDomain {
+  public:
+    static constexpr int MAX_THREADS        = 256;
+    static constexpr size_t COLLECT_EVERY   = 64;  // retirements between two attempts to advance and free
+    static constexpr std::uint64_t UNPINNED = std::numeric_limits<std::uint64_t>::max();
+
+  private:
+    struct Retired {
+        void *ptr;
+        void (*deleter)(void *);
+        std::uint64_t epoch;
+    };
+
+    struct alignas(64) Record {
+        std::atomic<std::uint64_t> epoch{UNPINNED};
+        std::atomic<bool> in_use{false};
+        int nesting = 0;
+        std::vector<Retired> limbo;  // owned by the thread holding the record, or by its next holder
+    };
+
+  public:
+    /**
+     * @brief Keeps the calling thread pinned while alive, nested guards are allowed
+     */
+    class Guard {
+      public:
+        Guard() = default;
+        explicit Guard(EpochDomain &domain) : m_record(&domain.local()) { domain.enter(*m_record); }
+        Guard(Guard const &other) : m_record(other.m_record) {
+            if (m_record) {
+                m_record->nesting++;
+            }
+        }
+        Guard(Guard &&other) noexcept : m_record(std::exchange(other.m_record, nullptr)) {}
+        Guard &operator=(Guard other) noexcept {
+            std::swap(m_record, other.m_record);
+            return *this;
+        }
+        ~Guard() {
+            if (m_record) {
+                leave(*m_record);
+            }
+        }
+
+      private:
+        Record *m_record = nullptr;
+    };
+
+    static EpochDomain &instance() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    EpochDomain(EpochDomain const &)            = delete;
+    EpochDomain &operator=(EpochDomain const &) = delete;
+    ~EpochDomain() {
+        for (auto &record : m_records) {
+            free_all(record.limbo);
+        }
+    }
+
+    Guard pin() { return Guard(*this); }
+
+    /**
+     * @brief Free `ptr` with `deleter` once no pinned thread can reach it any more
+     *
+     * @note `ptr` must already be unreachable for threads pinning from now on
+     */
+    void retire(void *ptr, void (*deleter)(void *)) {
+        Record &record = local();
+        record.limbo.push_back({ptr, deleter, m_epoch.load(std::memory_order_seq_cst)});
+        if (record.limbo.size() % COLLECT_EVERY == 0) {
+            collect(record);
+        }
+    }
+
+    /**
+     * @brief Try to advance the epoch and free what the calling thread retired long enough ago
+     */
+    void collect() { collect(local()); }
+
+  private:
+    EpochDomain() = default;
+
+    /**
+     * @brief Claims a record for the calling thread on construction, hands it over on thread exit
+     */
+    struct Handle {
+        EpochDomain &domain;
+        Record *record;
+
+        explicit Handle(EpochDomain &domain) : domain(domain), record(domain.claim()) {}
+        ~Handle() {
+            domain.collect(*record);
+            record->in_use.store(false, std::memory_order_release);
+        }
+    };
+
+    Record &local() {
+        thread_local Handle handle(*this);
+        return *handle.record;
+    }
+
+    Record *claim() {
+        for (auto &record : m_records) {
+            bool expected = false;
+            if (record.in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                int const index = static_cast<int>(&record - m_records.data());
+                int used        = m_used.load(std::memory_order_relaxed);
+                while (used <= index && !m_used.compare_exchange_weak(used, index + 1)) {
+                }
+                return &record;
+            }
+        }
+        throw std::runtime_error("EpochDomain: too many threads");
+    }
+
+    void enter(Record &record) {
+        if (record.nesting++ == 0) {
+            record.epoch.store(m_epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            // the announcement must be visible before any shared pointer is read
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    static void leave(Record &record) {
+        if (--record.nesting == 0) {
+            record.epoch.store(UNPINNED, std::memory_order_release);
+        }
+    }
+
+    void collect(Record &record) {
+        std::uint64_t epoch = m_epoch.load(std::memory_order_seq_cst);
+        if (can_advance(epoch) && m_epoch.compare_exchange_strong(epoch, epoch + 1)) {
+            epoch++;
+        }
+        auto const expired = [epoch](Retired const &retired) { return retired.epoch + 2 <= epoch; };
+        auto const kept    = std::stable_partition(record.limbo.begin(), record.limbo.end(), std::not_fn(expired));
+        for (auto itor = kept; itor != record.limbo.end(); ++itor) {
+            itor->deleter(itor->ptr);
+        }
+        record.limbo.erase(kept, record.limbo.end());
+    }
+
+    bool can_advance(std::uint64_t epoch) const {
+        int const used = m_used.load(std::memory_order_acquire);
+        for (int i = 0; i < used; i++) {
+            std::uint64_t const pinned = m_records[i].epoch.load(std::memory_order_seq_cst);
+            if (pinned != UNPINNED && pinned != epoch) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void free_all(std::vector<Retired> &limbo) {
+        for (auto const &retired : limbo) {
+            retired.deleter(retired.ptr);
+        }
+        limbo.clear();
+    }
+
+    std::atomic<std::uint64_t> m_epoch{0};
+    std::atomic<int> m_used{0};  // records past this index were never claimed
+    std::array<Record, MAX_THREADS> m_records;
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Immutable order statistic map, the read-only snapshot produced by `freeze()` of the mutable engines
+ *
+ * Pairs are kept in one array in Eytzinger (BFS) order: the children of slot k are 2k and 2k + 1, the first levels of
+ * the search share a few cache lines and the grandchildren a few levels down can be prefetched ahead of the
+ * comparisons. The slots form a complete binary tree, so the position of a slot and the slot at a position follow
+ * from the slot number and the size alone, no rank is stored.
+ */
+template <
+    typename K, typename V, typename Compare = std::less<K>, typename Allocator = std::allocator<std::pair<const K, V>>>
+class FrozenOrderStatistic {
+  public:
+    static constexpr int BASE_INDEX = 1;  // the base index of `findbypos`
+
+    using key_type       = K;
+    using value_type     = V;
+    using pair_type      = std::pair<key_type, value_type>;
+    using size_type      = size_t;
+    using key_compare    = Compare;
+    using allocator_type = Allocator;
+
+    /**
+     * @brief In-order walk over the slots, `*it` yields a pointer to the pair as the engines' iterators do
+     */
+    class iterator {
+      public:
+        iterator(FrozenOrderStatistic const *owner, size_type slot) : m_owner(owner), m_slot(slot) {}
+        bool operator==(const iterator &it) const { return m_slot == it.m_slot; }
+        bool operator!=(const iterator &it) const { return m_slot != it.m_slot; }
+        pair_type const *operator->() const { return &m_owner->at(m_slot); }
+        pair_type const *operator*() const { return &m_owner->at(m_slot); }
+
+        iterator &operator++() {
+            m_slot = m_owner->successor(m_slot);
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+
+      private:
+        FrozenOrderStatistic const *m_owner;
+        size_type m_slot;  // 0 past the end
+    };
+    using const_iterator = iterator;
+
+    explicit FrozenOrderStatistic(Compare const &cmp = Compare(), Allocator const &alloc = Allocator())
+        : m_cmp(cmp), m_pairs(pair_allocator(alloc)) {}
+
+    /**
+     * @brief Snapshot the pairs in [first, last)
+     *
+     * @note the range must be sorted by `cmp` and free of duplicate keys, as the iteration of an engine is
+     */
+    template <typename ForwardIt>
+    FrozenOrderStatistic(ForwardIt first, ForwardIt last, Compare const &cmp, Allocator const &alloc = Allocator())
+        : FrozenOrderStatistic(cmp, alloc) {
+        std::vector<pair_type> sorted;
+        for (; first != last; ++first) {
+            sorted.emplace_back(first->first, first->second);
+        }
+        m_pairs.reserve(sorted.size());
+        for (size_type k = 1; k <= sorted.size(); k++) {
+            m_pairs.push_back(std::move(sorted[rank_of(k, sorted.size())]));
+        }
+    }
+
+    iterator begin() const { return iterator(this, m_pairs.empty() ? 0 : leftmost(1)); }
+    iterator last() const {
+        size_type k = m_pairs.empty() ? 0 : 1;
+        while (k && 2 * k + 1 <= m_pairs.size()) {
+            k = 2 * k + 1;
+        }
+        return iterator(this, k);
+    }
+    iterator end() const { return iterator(this, 0); }
+    size_type size() const { return m_pairs.size(); }
+    key_compare key_comp() const { return m_cmp; }
+
+    /**
+     * @brief Branchless descent over the slots, prefetching the descendants `PREFETCH_LEVELS` down
+     */
+    iterator find(key_type const &key) const {
+        size_type const n = m_pairs.size();
+        size_type k       = 1;
+        while (k <= n) {
+            // clamped to the last slot, the descendants of the bottom levels lie past the array
+            __builtin_prefetch(&at(std::min(k * PREFETCH_STRIDE, n)));
+            k = 2 * k + m_cmp(at(k).first, key);
+        }
+        // the path went right after every node that was too small, drop those turns and the last left one
+        k >>= __builtin_ctzll(~k) + 1;
+        if (k == 0 || m_cmp(key, at(k).first)) {
+            return end();
+        }
+        return iterator(this, k);
+    }
+
+    /**
+     * @brief Find the pair by position, its slot computed from it in O(1)
+     *
+     * @param pos position of the pair to be found
+     * @note base index decided by `BASE_INDEX`
+     */
+    iterator findbypos(size_type pos) const {
+        size_type const n = m_pairs.size();
+        if (pos < BASE_INDEX || pos >= n + BASE_INDEX) {
+            return end();
+        }
+        return iterator(this, slot_of(pos - BASE_INDEX, n));
+    }
+
+  private:
+    static constexpr size_type PREFETCH_LEVELS = 4;
+    static constexpr size_type PREFETCH_STRIDE = size_type(1) << PREFETCH_LEVELS;
+
+    using pair_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<pair_type>;
+
+    pair_type const &at(size_type k) const { return m_pairs[k - 1]; }
+
+    static size_type floor_log2(size_type n) { return 63 - __builtin_clzll(n); }
+
+    /**
+     * @brief Slot of the pair at `rank`, from 0, in a tree of `n`
+     *
+     * The slots are those of a perfect tree one level deeper, less its last leaves. Numbered from 1 in key order, that
+     * tree has its leaves on the odd numbers and the kept ones come first: up to twice their count the numbers are the
+     * positions from 1, past it only the even ones are left. Number p sits as many levels above the bottom as it has
+     * trailing zeros, at index p >> (zeros + 1) of its level.
+     */
+    static size_type slot_of(size_type rank, size_type n) {
+        size_type const height = floor_log2(n);
+        size_type const leaves = 2 * (n + 1 - (size_type(1) << height));  // twice the slots on the bottom level
+        size_type const p      = rank + 1 <= leaves ? rank + 1 : 2 * (rank + 1) - leaves;
+        size_type const zeros  = __builtin_ctzll(p);
+        return (p >> (zeros + 1)) | (size_type(1) << (height - zeros));
+    }
+
+    /**
+     * @brief Rank, from 0, of slot `k` in a tree of `n`, the inverse of `slot_of`
+     */
+    static size_type rank_of(size_type k, size_type n) {
+        size_type const height = floor_log2(n);
+        size_type const leaves = 2 * (n + 1 - (size_type(1) << height));
+        size_type const depth  = floor_log2(k);
+        size_type const p      = (2 * (k - (size_type(1) << depth)) + 1) << (height - depth);
+        return (p <= leaves ? p : (p + leaves) / 2) - 1;
+    }
+
+    size_type leftmost(size_type k) const {
+        while (2 * k <= m_pairs.size()) {
+            k = 2 * k;
+        }
+        return k;
+    }
+
+    /**
+     * @brief Slot following `k` in key order, 0 after the last one
+     */
+    size_type successor(size_type k) const {
+        if (2 * k + 1 <= m_pairs.size()) {
+            return leftmost(2 * k + 1);
+        }
+        // climb over the right turns, then once more to the node the left turn came from
+        return k >> (__builtin_ctzll(~k) + 1);
+    }
+
+    Compare m_cmp;
+    std::vector<pair_type, pair_allocator> m_pairs;  // slot k at index k - 1
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * @brief Run `count` independent pointer-chasing searches `Width` at a time, advanced round robin one hop each
+ *
+ * A search prefetches the node it is going to read next and yields to the other lanes, so by the time it comes back
+ * that node is in cache and up to `Width` misses are in flight at once instead of one. A finished lane takes the next
+ * search right away, searches of different lengths never leave it idle.
+ *
+ * @param start `bool(size_t i, Lane &lane)` set `lane` up for search `i` and prefetch its first node, false when the
+ * search is already resolved
+ * @param step `bool(size_t i, Lane &lane)` make one hop of search `i` and prefetch the next node, false once resolved
+ */
+template <size_t Width, typename Lane, typename Start, typename Step>
+void interleave_searches(size_t count, Start const &start, Step const &step) {
+    Lane lanes[Width];
+    size_t searches[Width];
+    size_t active = 0;
+    size_t next   = 0;
+
+    // put the next unresolved search in `lane`, if any is left
+    auto const refill = [&](size_t lane) {
+        while (next < count) {
+            size_t const i = next++;
+            if (start(i, lanes[lane])) {
+                searches[lane] = i;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    while (active < Width && refill(active)) {
+        active++;
+    }
+    while (active) {
+        for (size_t lane = 0; lane < active;) {
+            if (step(searches[lane], lanes[lane]) || refill(lane)) {
+                lane++;
+                continue;
+            }
+            // nothing left to start, the last lane takes this slot and gets its turn now
+            active--;
+            lanes[lane]    = lanes[active];
+            searches[lane] = searches[active];
+        }
+    }
+}
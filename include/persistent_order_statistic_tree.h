@@ -0,0 +1,413 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <utility>
+
+#include "epoch.h"
+
+/**
+ * @brief Persistent AVL order statistic tree: every version stays readable, `snapshot()` takes one in O(1)
+ *
+ * Nodes are immutable and reference counted. `insert` and `erase` copy the root-to-leaf path they change and share
+ * every other node with the previous version, so a write costs O(log n) fresh nodes and a version costs nothing until
+ * it is written to.
+ *
+ * One thread at a time may write, any number may call `snapshot()` concurrently: the writer publishes each new root
+ * with an atomic store and hands its reference to the old one to `EpochDomain`, so that a reader between loading the
+ * root and taking its reference never sees it freed. A `Snapshot` is then private to its holder, as is any copy of the
+ * tree, which is O(1) as well. The readers of the tree itself, `find`, `begin` and the like, take no reference to the
+ * root they load: they belong to the writing thread, other threads read through `snapshot()`.
+ *
+ * Kept apart from `AvlOrderStatisticTree` rather than as a mode of it: nodes shared between versions can have neither
+ * parent links nor sizes updated in place, which that tree relies on throughout.
+ *
+ * Nodes are shared between versions and may outlive the tree, so they come from `new` rather than an allocator.
+ */
+template <typename K, typename V, typename Compare = std::less<K>>
+class PersistentOrderStatisticTree {
+  public:
+    static constexpr int BASE_INDEX = 1;   // the base index of `findbypos`
+    static constexpr int MAX_HEIGHT = 64;  // an AVL tree of height 64 holds more than 2^44 nodes
+
+    using key_type    = K;
+    using value_type  = V;
+    using pair_type   = std::pair<key_type, value_type>;
+    using size_type   = size_t;
+    using key_compare = Compare;
+
+  private:
+    struct Node;
+
+    /**
+     * @brief Owning reference to a node
+     */
+    class Ref {
+      public:
+        Ref() = default;
+        explicit Ref(Node const *adopted) : m_ptr(adopted) {}
+        Ref(Ref const &other) : m_ptr(acquire(other.m_ptr)) {}
+        Ref(Ref &&other) noexcept : m_ptr(std::exchange(other.m_ptr, nullptr)) {}
+        Ref &operator=(Ref other) noexcept {
+            std::swap(m_ptr, other.m_ptr);
+            return *this;
+        }
+        ~Ref() { release(m_ptr); }
+
+        Node const *get() const { return m_ptr; }
+        Node const *operator->() const { return m_ptr; }
+        explicit operator bool() const { return m_ptr != nullptr; }
+
+        /**
+         * @brief Give up the reference without dropping it
+         */
+        Node const *detach() { return std::exchange(m_ptr, nullptr); }
+
+        static Node const *acquire(Node const *node) {
+            if (node) {
+                node->refs.fetch_add(1, std::memory_order_relaxed);
+            }
+            return node;
+        }
+        static void release(Node const *node) {
+            if (node && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete node;
+            }
+        }
+
+      private:
+        Node const *m_ptr = nullptr;
+    };
+
+    struct Node {
+        pair_type data;
+        Ref left, right;
+        int height;
+        size_type size;
+        mutable std::atomic<std::uint32_t> refs{1};
+
+        Node(pair_type data, Ref left, Ref right)
+            : data(std::move(data)), left(std::move(left)), right(std::move(right)),
+              height(1 + std::max(height_of(this->left.get()), height_of(this->right.get()))),
+              size(1 + size_of(this->left.get()) + size_of(this->right.get())) {}
+    };
+
+  public:
+    /**
+     * @brief Bidirectional iterator keeping the path from the root, nodes have no parent link to follow
+     */
+    class const_iterator {
+      public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = pair_type;
+        using difference_type   = ptrdiff_t;
+        using pointer           = value_type const *;
+        using reference         = value_type const &;
+
+        const_iterator() = default;
+
+        bool operator==(const const_iterator &other) const { return current() == other.current(); }
+        bool operator!=(const const_iterator &other) const { return current() != other.current(); }
+
+        reference operator*() const { return current()->data; }
+        pointer operator->() const { return &current()->data; }
+
+        const_iterator &operator++() {
+            Node const *node = current();
+            if (node->right) {
+                push_extreme(node->right.get(), &Node::left);
+            } else {
+                // climb while coming from a right child, the first ancestor reached from its left is the successor
+                do {
+                    node = m_path[--m_depth];
+                } while (m_depth > 0 && m_path[m_depth - 1]->right.get() == node);
+            }
+            return *this;
+        }
+        const_iterator &operator--() {
+            if (m_depth == 0) {
+                push_extreme(m_root, &Node::right);
+                return *this;
+            }
+            Node const *node = current();
+            if (node->left) {
+                push_extreme(node->left.get(), &Node::right);
+            } else {
+                do {
+                    node = m_path[--m_depth];
+                } while (m_depth > 0 && m_path[m_depth - 1]->left.get() == node);
+            }
+            return *this;
+        }
+        const_iterator operator++(int) {
+            auto temp(*this);
+            ++(*this);
+            return temp;
+        }
+        const_iterator operator--(int) {
+            auto temp(*this);
+            --(*this);
+            return temp;
+        }
+
+      private:
+        friend class PersistentOrderStatisticTree;
+
+        explicit const_iterator(Node const *root) : m_root(root) {}
+
+        Node const *current() const { return m_depth ? m_path[m_depth - 1] : nullptr; }
+
+        void push(Node const *node) { m_path[m_depth++] = node; }
+
+        /**
+         * @brief Push `node` and its descendants along `side`, ending on the extreme node of that subtree
+         */
+        void push_extreme(Node const *node, Ref Node::*side) {
+            for (; node; node = (node->*side).get()) {
+                push(node);
+            }
+        }
+
+        Node const *m_root = nullptr;
+        Node const *m_path[MAX_HEIGHT];
+        int m_depth = 0;  // empty path is `end()`
+    };
+
+    using iterator = const_iterator;
+
+    /**
+     * @brief Read-only version of the tree, unaffected by later writes
+     */
+    class Snapshot {
+      public:
+        static constexpr int BASE_INDEX = PersistentOrderStatisticTree::BASE_INDEX;
+
+        Snapshot() = default;
+
+        size_type size() const { return size_of(m_root.get()); }
+        const_iterator begin() const { return first_of(m_root.get()); }
+        const_iterator last() const { return last_of(m_root.get()); }
+        const_iterator end() const { return const_iterator(m_root.get()); }
+        const_iterator find(key_type const &key) const { return find_in(m_root.get(), key, m_cmp); }
+        const_iterator findbypos(size_type pos) const { return findbypos_in(m_root.get(), pos); }
+
+      private:
+        friend class PersistentOrderStatisticTree;
+
+        Snapshot(Ref root, Compare const &cmp) : m_root(std::move(root)), m_cmp(cmp) {}
+
+        Ref m_root;
+        Compare m_cmp;
+    };
+
+    explicit PersistentOrderStatisticTree(Compare const &cmp = Compare()) : m_cmp(cmp) {}
+    PersistentOrderStatisticTree(PersistentOrderStatisticTree const &other)
+        : m_cmp(other.m_cmp), m_root(Ref::acquire(other.root())) {}
+    PersistentOrderStatisticTree &operator=(PersistentOrderStatisticTree const &other) {
+        if (&other != this) {
+            m_cmp = other.m_cmp;
+            publish(Ref(Ref::acquire(other.root())));
+        }
+        return *this;
+    }
+    ~PersistentOrderStatisticTree() { Ref::release(root()); }
+
+    /**
+     * @brief The current version, safe to call while another thread writes
+     */
+    Snapshot snapshot() const {
+        auto guard = EpochDomain::instance().pin();
+        return Snapshot(Ref(Ref::acquire(m_root.load(std::memory_order_acquire))), m_cmp);
+    }
+
+    key_compare key_comp() const { return m_cmp; }
+
+    /* reads of the current version, from the writing thread only */
+
+    size_type size() const { return size_of(root()); }
+    const_iterator begin() const { return first_of(root()); }
+    const_iterator last() const { return last_of(root()); }
+    const_iterator end() const { return const_iterator(root()); }
+    const_iterator find(key_type const &key) const { return find_in(root(), key, m_cmp); }
+
+    /**
+     * @brief Find the pair by position
+     *
+     * @param pos position of the pair to be found
+     * @note base index decided by `BASE_INDEX`
+     */
+    const_iterator findbypos(size_type pos) const { return findbypos_in(root(), pos); }
+
+    void insert(pair_type const &p) { insert(p.first, p.second); }
+    void insert(key_type const &key, value_type const &value) { publish(insert(root(), key, value)); }
+
+    /**
+     * @return the number of pairs erased, 0 or 1
+     */
+    size_type erase(key_type const &key) {
+        bool erased = false;
+        Ref root    = erase(this->root(), key, erased);
+        if (!erased) {
+            return 0;
+        }
+        publish(std::move(root));
+        return 1;
+    }
+
+    void clear() { publish(Ref()); }
+
+  private:
+    static int height_of(Node const *node) { return node ? node->height : 0; }
+    static size_type size_of(Node const *node) { return node ? node->size : 0; }
+
+    Node const *root() const { return m_root.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Make `root` the current version, the previous one is dropped once no reader can be taking it
+     */
+    void publish(Ref root) {
+        Node const *const old = m_root.exchange(root.detach(), std::memory_order_acq_rel);
+        if (old) {
+            EpochDomain::instance().retire(const_cast<Node *>(old), [](void *node) {
+                Ref::release(static_cast<Node const *>(node));
+            });
+        }
+    }
+
+    /* searching, shared by the tree and its snapshots */
+
+    static const_iterator first_of(Node const *root) {
+        const_iterator itor(root);
+        itor.push_extreme(root, &Node::left);
+        return itor;
+    }
+
+    static const_iterator last_of(Node const *root) {
+        const_iterator itor(root);
+        itor.push_extreme(root, &Node::right);
+        return itor;
+    }
+
+    static const_iterator find_in(Node const *root, key_type const &key, Compare const &cmp) {
+        const_iterator itor(root);
+        for (Node const *node = root; node;) {
+            itor.push(node);
+            if (cmp(key, node->data.first)) {
+                node = node->left.get();
+            } else if (cmp(node->data.first, key)) {
+                node = node->right.get();
+            } else {
+                return itor;
+            }
+        }
+        return const_iterator(root);
+    }
+
+    static const_iterator findbypos_in(Node const *root, size_type pos) {
+        if (pos < BASE_INDEX || pos >= size_of(root) + BASE_INDEX) {
+            return const_iterator(root);
+        }
+        pos -= BASE_INDEX;
+        const_iterator itor(root);
+        for (Node const *node = root;;) {
+            itor.push(node);
+            size_type const left_size = size_of(node->left.get());
+            if (pos < left_size) {
+                node = node->left.get();
+            } else if (pos > left_size) {
+                pos -= left_size + 1;
+                node = node->right.get();
+            } else {
+                return itor;
+            }
+        }
+    }
+
+    /* path copying */
+
+    static Ref make(pair_type data, Ref left, Ref right) {
+        return Ref(new Node(std::move(data), std::move(left), std::move(right)));
+    }
+
+    /**
+     * @brief New node over `left` and `right`, whose heights differ by at most 2, rotated back into AVL shape
+     */
+    static Ref balance(pair_type data, Ref left, Ref right) {
+        int const diff = height_of(left.get()) - height_of(right.get());
+        if (diff > 1) {
+            if (height_of(left->left.get()) >= height_of(left->right.get())) {
+                return make(left->data, left->left, make(std::move(data), left->right, std::move(right)));
+            }
+            Node const *const pivot = left->right.get();
+            return make(
+                pivot->data, make(left->data, left->left, pivot->left),
+                make(std::move(data), pivot->right, std::move(right))
+            );
+        }
+        if (diff < -1) {
+            if (height_of(right->right.get()) >= height_of(right->left.get())) {
+                return make(right->data, make(std::move(data), std::move(left), right->left), right->right);
+            }
+            Node const *const pivot = right->left.get();
+            return make(
+                pivot->data, make(std::move(data), std::move(left), pivot->left),
+                make(right->data, pivot->right, right->right)
+            );
+        }
+        return make(std::move(data), std::move(left), std::move(right));
+    }
+
+    Ref insert(Node const *node, key_type const &key, value_type const &value) const {
+        if (!node) {
+            return make(pair_type(key, value), Ref(), Ref());
+        }
+        if (m_cmp(key, node->data.first)) {
+            return balance(node->data, insert(node->left.get(), key, value), node->right);
+        }
+        if (m_cmp(node->data.first, key)) {
+            return balance(node->data, node->left, insert(node->right.get(), key, value));
+        }
+        return make(pair_type(key, value), node->left, node->right);
+    }
+
+    /**
+     * @param erased set when `key` is found, the path is copied only then and an empty reference returned otherwise
+     */
+    Ref erase(Node const *node, key_type const &key, bool &erased) const {
+        if (!node) {
+            return Ref();
+        }
+        if (m_cmp(key, node->data.first)) {
+            Ref left = erase(node->left.get(), key, erased);
+            return erased ? balance(node->data, std::move(left), node->right) : Ref();
+        }
+        if (m_cmp(node->data.first, key)) {
+            Ref right = erase(node->right.get(), key, erased);
+            return erased ? balance(node->data, node->left, std::move(right)) : Ref();
+        }
+        erased = true;
+        if (!node->left || !node->right) {
+            return node->left ? node->left : node->right;
+        }
+        // the successor stays alive in the previous version while it is copied into the new one
+        Node const *successor = node->right.get();
+        while (successor->left) {
+            successor = successor->left.get();
+        }
+        return balance(successor->data, node->left, erase_min(node->right.get()));
+    }
+
+    static Ref erase_min(Node const *node) {
+        if (!node->left) {
+            return node->right;
+        }
+        return balance(node->data, erase_min(node->left.get()), node->right);
+    }
+
+    Compare m_cmp;
+    std::atomic<Node const *> m_root{nullptr};  // the tree holds one reference to it
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "avl_order_statistic_tree.h"
+
+/**
+ * @brief Positional map split into key range shards, each an engine behind its own lock
+ *
+ * Writers to different ranges never meet on a lock or on the top of a tree. A Fenwick tree over the shard sizes turns
+ * a position into a shard and a position inside it in O(log shards), the shard's own `findbypos` does the rest.
+ *
+ * Boundaries start out unknown, every key goes to the first shard. Whenever a shard grows past twice the average size
+ * (plus some slack for small maps), all pairs are redistributed evenly and the boundaries moved, under an exclusive
+ * lock on the layout. A shard has to take in at least an average share of insertions between two redistributions, so
+ * each insertion pays for moving O(shards) pairs, amortized.
+ *
+ * Lookups return copies since no reference into a shard survives its lock. With concurrent writers, `findbypos`
+ * returns the pair at `pos` in some state the shard went through, not necessarily the state of the whole map at one
+ * point in time; it is exact when no writer is running.
+ *
+ * @tparam Engine `AvlOrderStatisticTree`, `SkipList` or `BTreeOrderStatistic` over the same K and V
+ */
+template <typename K, typename V, typename Engine = AvlOrderStatisticTree<K, V>>
+class ShardedPositionalMap {
+  public:
+    static constexpr int BASE_INDEX         = 1;     // the base index of `findbypos`
+    static constexpr size_t REBALANCE_SLACK = 1024;  // a shard is never rebalanced below that size
+    static constexpr size_t DEFAULT_SHARDS  = 16;
+
+    using key_type    = K;
+    using value_type  = V;
+    using pair_type   = std::pair<key_type, value_type>;
+    using size_type   = size_t;
+    using key_compare = typename Engine::key_compare;
+
+    explicit ShardedPositionalMap(size_type shards = DEFAULT_SHARDS, key_compare const &cmp = key_compare())
+        : m_cmp(cmp), m_shards(std::max<size_type>(shards, 1)), m_sizes(m_shards.size()) {
+        for (auto &shard : m_shards) {
+            shard.map = std::make_unique<Engine>(cmp);
+        }
+    }
+    ShardedPositionalMap(ShardedPositionalMap const &)            = delete;
+    ShardedPositionalMap &operator=(ShardedPositionalMap const &) = delete;
+
+    size_type size() const { return m_sizes.total(); }
+    size_type shard_count() const { return m_shards.size(); }
+    key_compare key_comp() const { return m_cmp; }
+
+    void insert(pair_type const &p) { insert(p.first, p.second); }
+    void insert(key_type const &key, value_type const &value) {
+        bool skewed = false;
+        {
+            std::shared_lock layout(m_layout);
+            size_type const index = route(key);
+            Shard &shard          = m_shards[index];
+            std::unique_lock lock(shard.mutex);
+            size_type const before = shard.map->size();
+            shard.map->insert(key, value);
+            size_type const after = shard.map->size();
+            if (after != before) {
+                m_sizes.add(index, 1);
+                skewed = after > rebalance_threshold();
+            }
+        }
+        if (skewed) {
+            rebalance();
+        }
+    }
+
+    /**
+     * @return whether the key was present
+     */
+    bool erase(key_type const &key) {
+        std::shared_lock layout(m_layout);
+        size_type const index = route(key);
+        Shard &shard          = m_shards[index];
+        std::unique_lock lock(shard.mutex);
+        size_type const before = shard.map->size();
+        shard.map->erase(key);
+        if (shard.map->size() == before) {
+            return false;
+        }
+        m_sizes.add(index, -1);
+        return true;
+    }
+
+    std::optional<value_type> find(key_type const &key) const {
+        std::shared_lock layout(m_layout);
+        Shard const &shard = m_shards[route(key)];
+        std::shared_lock lock(shard.mutex);
+        if (auto itor = shard.map->find(key); itor != shard.map->end()) {
+            return itor->second;
+        }
+        return std::nullopt;
+    }
+
+    bool contains(key_type const &key) const { return find(key).has_value(); }
+
+    /**
+     * @brief Find the pair by position
+     *
+     * @param pos position of the pair to be found
+     * @note base index decided by `BASE_INDEX`
+     */
+    std::optional<pair_type> findbypos(size_type pos) const {
+        std::shared_lock layout(m_layout);
+        while (pos >= BASE_INDEX && pos < m_sizes.total() + BASE_INDEX) {
+            auto const [index, local] = m_sizes.locate(pos - BASE_INDEX);
+            Shard const &shard        = m_shards[index];
+            std::shared_lock lock(shard.mutex);
+            // the sizes may have moved since they were read, then try again
+            if (local < static_cast<size_type>(shard.map->size())) {
+                auto itor = shard.map->findbypos(local + 1);
+                return pair_type(itor->first, itor->second);
+            }
+        }
+        return std::nullopt;
+    }
+
+  private:
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::unique_ptr<Engine> map;
+    };
+
+    /**
+     * @brief Fenwick tree of shard sizes, updated with relaxed atomics by writers holding different shard locks
+     */
+    class ShardSizes {
+      public:
+        explicit ShardSizes(size_type count) : m_tree(count + 1) {}
+
+        void add(size_type index, ptrdiff_t delta) {
+            for (size_type i = index + 1; i < m_tree.size(); i += i & -i) {
+                m_tree[i].fetch_add(delta, std::memory_order_relaxed);
+            }
+        }
+
+        size_type total() const {
+            ptrdiff_t sum = 0;
+            for (size_type i = m_tree.size() - 1; i > 0; i -= i & -i) {
+                sum += m_tree[i].load(std::memory_order_relaxed);
+            }
+            return static_cast<size_type>(std::max<ptrdiff_t>(sum, 0));
+        }
+
+        /**
+         * @brief Shard holding the 0-based position `pos`, and the 0-based position inside it
+         */
+        std::pair<size_type, size_type> locate(size_type pos) const {
+            size_type index = 0;
+            size_type step  = 1;
+            while (step * 2 < m_tree.size()) {
+                step *= 2;
+            }
+            for (; step; step /= 2) {
+                if (index + step < m_tree.size()) {
+                    ptrdiff_t const size = m_tree[index + step].load(std::memory_order_relaxed);
+                    if (size >= 0 && static_cast<size_type>(size) <= pos) {
+                        index += step;
+                        pos -= size;
+                    }
+                }
+            }
+            return {std::min(index, m_tree.size() - 2), pos};
+        }
+
+        void reset(std::vector<size_type> const &sizes) {
+            for (auto &node : m_tree) {
+                node.store(0, std::memory_order_relaxed);
+            }
+            for (size_type i = 0; i < sizes.size(); i++) {
+                add(i, static_cast<ptrdiff_t>(sizes[i]));
+            }
+        }
+
+      private:
+        std::vector<std::atomic<ptrdiff_t>> m_tree;  // 1-based
+    };
+
+    /**
+     * @brief Shard whose range holds `key`, the layout must be locked
+     */
+    size_type route(key_type const &key) const {
+        return std::upper_bound(m_bounds.begin(), m_bounds.end(), key, m_cmp) - m_bounds.begin();
+    }
+
+    size_type rebalance_threshold() const { return 2 * m_sizes.total() / m_shards.size() + REBALANCE_SLACK; }
+
+    /**
+     * @brief Spread all pairs evenly over the shards and move the boundaries accordingly
+     */
+    void rebalance() {
+        std::unique_lock layout(m_layout);
+        size_type const threshold = rebalance_threshold();
+        auto const too_large      = [threshold](Shard const &shard) {
+            return static_cast<size_type>(shard.map->size()) > threshold;
+        };
+        if (std::none_of(m_shards.begin(), m_shards.end(), too_large)) {
+            return;  // another writer got there first
+        }
+
+        std::vector<pair_type> pairs;
+        pairs.reserve(m_sizes.total());
+        for (auto &shard : m_shards) {
+            for (auto itor = shard.map->begin(); itor != shard.map->end(); ++itor) {
+                pairs.emplace_back(itor->first, itor->second);
+            }
+            shard.map->clear();
+        }
+
+        size_type const count = m_shards.size();
+        std::vector<size_type> sizes(count);
+        m_bounds.clear();
+        for (size_type i = 0; i < count; i++) {
+            auto const first = pairs.begin() + pairs.size() * i / count;
+            auto const last  = pairs.begin() + pairs.size() * (i + 1) / count;
+            if (i > 0) {
+                // an empty shard gets the bound of the next one, it stays empty until keys fall in its range
+                m_bounds.push_back(first != pairs.end() ? first->first : pairs.back().first);
+            }
+            fill(*m_shards[i].map, first, last);
+            sizes[i] = last - first;
+        }
+        m_sizes.reset(sizes);
+    }
+
+    using pair_iterator = typename std::vector<pair_type>::iterator;
+
+    template <typename T, typename = void>
+    struct has_build_from_sorted : std::false_type {};
+    template <typename T>
+    struct has_build_from_sorted<
+        T, std::void_t<decltype(std::declval<T &>().build_from_sorted(pair_iterator(), pair_iterator()))>>
+        : std::true_type {};
+
+    static void fill(Engine &map, pair_iterator first, pair_iterator last) {
+        if constexpr (has_build_from_sorted<Engine>::value) {
+            map.build_from_sorted(first, last);
+        } else {
+            for (; first != last; ++first) {
+                map.insert(first->first, first->second);
+            }
+        }
+    }
+
+    key_compare m_cmp;
+    mutable std::shared_mutex m_layout;  // shared by every operation, exclusive while the boundaries move
+    std::vector<Shard> m_shards;
+    std::vector<key_type> m_bounds;  // m_bounds[i - 1] is the first key of shard i, empty until the first rebalance
+    ShardSizes m_sizes;
+};
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Fixed set of worker threads running the forked halves of fork-join recursions
+ *
+ * `fork_join(f, g)` offers `g` to the workers, runs `f` on the calling thread, then takes `g` back if no worker has
+ * picked it up yet. A thread waiting for a stolen half keeps running other offered tasks meanwhile, so recursions
+ * nested to any depth never leave a thread blocked while work is pending, and a pool without workers simply runs
+ * everything inline.
+ *
+ * Workers take the oldest offered task, which in a recursion is the largest one left.
+ */
+class ThreadPool {
+  public:
+    /**
+     * @param workers threads besides the callers of `fork_join`
+     */
+    explicit ThreadPool(unsigned workers = std::max(std::thread::hardware_concurrency(), 1u) - 1) {
+        for (unsigned i = 0; i < workers; i++) {
+            m_workers.emplace_back([this] { work(); });
+        }
+    }
+    ThreadPool(ThreadPool const &)            = delete;
+    ThreadPool &operator=(ThreadPool const &) = delete;
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wakeup.notify_all();
+        for (auto &worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    /**
+     * @brief Pool shared by the whole process, one worker per hardware thread besides the caller
+     */
+    static ThreadPool &instance() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    unsigned workers() const { return static_cast<unsigned>(m_workers.size()); }
+
+    /**
+     * @brief Run `f` and `g`, possibly in parallel, and return once both are done
+     *
+     * @note an exception thrown by either is rethrown here once both have finished, the one of `f` first
+     */
+    template <typename F, typename G>
+    void fork_join(F &&f, G &&g) {
+        if (m_workers.empty()) {
+            f();
+            g();
+            return;
+        }
+        Task task(std::ref(g));
+        offer(&task);
+        std::exception_ptr error;
+        try {
+            f();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        if (take_back(&task)) {
+            task.run();
+        } else {
+            while (!task.done.load(std::memory_order_acquire)) {
+                if (!run_one()) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        if (task.error) {
+            std::rethrow_exception(task.error);
+        }
+    }
+
+    /**
+     * @brief Call `f(begin, end)` on disjoint chunks covering [first, last), in parallel down to `grain` indices
+     *
+     * The range is halved recursively through `fork_join`, so idle workers pick up the largest chunks left.
+     */
+    template <typename F>
+    void parallel_for(size_t first, size_t last, size_t grain, F const &f) {
+        if (m_workers.empty() || last - first <= std::max<size_t>(grain, 1)) {
+            if (first < last) {
+                f(first, last);
+            }
+            return;
+        }
+        size_t const mid = first + (last - first) / 2;
+        fork_join([&] { parallel_for(first, mid, grain, f); }, [&] { parallel_for(mid, last, grain, f); });
+    }
+
+  private:
+    struct Task {
+        std::function<void()> body;
+        std::atomic<bool> done{false};
+        std::exception_ptr error;
+
+        explicit Task(std::function<void()> body) : body(std::move(body)) {}
+
+        void run() {
+            try {
+                body();
+            } catch (...) {
+                error = std::current_exception();
+            }
+            done.store(true, std::memory_order_release);
+        }
+    };
+
+    void offer(Task *task) {
+        {
+            std::lock_guard lock(m_mutex);
+            m_tasks.push_back(task);
+        }
+        m_wakeup.notify_one();
+    }
+
+    /**
+     * @brief Withdraw `task` if no thread has taken it yet, it is then the caller's to run
+     */
+    bool take_back(Task *task) {
+        std::lock_guard lock(m_mutex);
+        // the task offered last is at the back unless the caller ran into a steal
+        auto const itor = std::find(m_tasks.rbegin(), m_tasks.rend(), task);
+        if (itor == m_tasks.rend()) {
+            return false;
+        }
+        m_tasks.erase(std::next(itor).base());
+        return true;
+    }
+
+    /**
+     * @brief Run the oldest offered task, if any
+     */
+    bool run_one() {
+        Task *task;
+        {
+            std::lock_guard lock(m_mutex);
+            if (m_tasks.empty()) {
+                return false;
+            }
+            task = m_tasks.front();
+            m_tasks.pop_front();
+        }
+        task->run();
+        return true;
+    }
+
+    void work() {
+        while (true) {
+            Task *task;
+            {
+                std::unique_lock lock(m_mutex);
+                m_wakeup.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+                if (m_tasks.empty()) {
+                    return;
+                }
+                task = m_tasks.front();
+                m_tasks.pop_front();
+            }
+            task->run();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::deque<Task *> m_tasks;  // offered and not taken yet, a task belongs to whoever removes it
+    bool m_stopping = false;
+    std::vector<std::thread> m_workers;
+};
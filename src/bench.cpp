@@ -7,6 +7,13 @@
 
 #include "SkipList.h"
 #include "avl_order_statistic_tree.h"
+#include "btree_order_statistic.h"
+#include "compact_avl_order_statistic_tree.h"
+#include "concurrent_skip_list.h"
+#include "deterministic_skip_list.h"
+#include "persistent_order_statistic_tree.h"
+#include "sharded_positional_map.h"
+#include "thread_pool.h"
 #include "bench.h"
 
 constexpr auto SLEEP_TIME = std::chrono::milliseconds(1);
@@ -53,7 +60,7 @@ int main() {
             {
                 cout << "SkipList:" << endl;
                 Duration duration_insert = Duration(0), duration_find = Duration(0), duration_findbypos = Duration(0),
-                         duration_erase = Duration(0);
+                         duration_erase = Duration(0), duration_rank = Duration(0), duration_count_range = Duration(0);
                 for (auto i = iteration_time; i; i--) {
                     SkipList<int, int> skip_list_map;
                     duration_insert += measure_insert(skip_list_map, input);
@@ -61,17 +68,20 @@ int main() {
                     assert(skip_list_map[random_key] == random_key);
                     duration_find += measure_find(skip_list_map);
                     duration_findbypos += measure_findbypos(skip_list_map);
+                    duration_rank += measure_rank(skip_list_map);
+                    duration_count_range += measure_count_range(skip_list_map);
                     duration_erase += measure_erase(skip_list_map);
                     std::this_thread::sleep_for(SLEEP_TIME);
                 }
                 print_time(duration_insert, duration_find, duration_findbypos, duration_erase, iteration_time);
+                print_rank_time(duration_rank, duration_count_range, iteration_time);
                 cout << endl;
             }
 
             {
                 cout << "AvlOrderStatisticTree:" << endl;
                 Duration duration_insert = Duration(0), duration_find = Duration(0), duration_findbypos = Duration(0),
-                         duration_erase = Duration(0);
+                         duration_erase = Duration(0), duration_rank = Duration(0), duration_count_range = Duration(0);
                 for (auto i = iteration_time; i; i--) {
                     AvlOrderStatisticTree<int, int> avl_tree;
                     duration_insert += measure_insert(avl_tree, input);
@@ -79,12 +89,334 @@ int main() {
                     assert(avl_tree[random_key] == random_key);
                     duration_find += measure_find(avl_tree);
                     duration_findbypos += measure_findbypos(avl_tree);
+                    duration_rank += measure_rank(avl_tree);
+                    duration_count_range += measure_count_range(avl_tree);
                     duration_erase += measure_erase(avl_tree);
                     std::this_thread::sleep_for(SLEEP_TIME);
                 }
                 print_time(duration_insert, duration_find, duration_findbypos, duration_erase, iteration_time);
+                print_rank_time(duration_rank, duration_count_range, iteration_time);
+                cout << endl;
+            }
+
+            {
+                cout << "SkipList bulk operations:" << endl;
+                for (unsigned threads : {1, 2, 4, 8, 16}) {
+                    ThreadPool pool(threads - 1);
+                    BulkDurations bulk{};
+                    for (auto i = iteration_time; i; i--) {
+                        auto const durations = measure_bulk<SkipList<int, int>>(input, pool);
+                        bulk.build += durations.build;
+                        bulk.find_many += durations.find_many;
+                        bulk.findbypos_many += durations.findbypos_many;
+                        bulk.to_vector += durations.to_vector;
+                    }
+                    print_bulk_time(threads, bulk, iteration_time);
+                }
+                cout << endl;
+            }
+
+            {
+                cout << "AvlOrderStatisticTree bulk operations:" << endl;
+                for (unsigned threads : {1, 2, 4, 8, 16}) {
+                    ThreadPool pool(threads - 1);
+                    BulkDurations bulk{};
+                    for (auto i = iteration_time; i; i--) {
+                        auto const durations = measure_bulk<AvlOrderStatisticTree<int, int>>(input, pool);
+                        bulk.build += durations.build;
+                        bulk.find_many += durations.find_many;
+                        bulk.findbypos_many += durations.findbypos_many;
+                        bulk.to_vector += durations.to_vector;
+                    }
+                    print_bulk_time(threads, bulk, iteration_time);
+                }
+                cout << endl;
+            }
+
+            {
+                // the input merged as a delta of odd keys into a tree of the even ones
+                cout << "AvlOrderStatisticTree union_with:" << endl;
+                unsigned const thread_counts[] = {1, 2, 4, 8, 16};
+                for (auto threads : thread_counts) {
+                    ThreadPool pool(threads - 1);
+                    Duration duration_union = Duration(0);
+                    for (auto i = iteration_time; i; i--) {
+                        AvlOrderStatisticTree<int, int> avl_tree, delta;
+                        for (auto key : input) {
+                            (key % 2 ? delta : avl_tree).insert(key, key);
+                        }
+                        auto start_union = chrono::high_resolution_clock::now();
+                        avl_tree.union_with(std::move(delta), pool);
+                        duration_union += Duration(chrono::high_resolution_clock::now() - start_union) / size;
+                        assert(avl_tree.size() == size);
+                    }
+                    cout << "Union with " << threads << " threads (wall clock per element): "
+                         << duration_union.count() / iteration_time << " ns" << endl;
+                }
+                cout << endl;
+            }
+
+            {
+                cout << "Frozen SkipList:" << endl;
+                Duration duration_find = Duration(0), duration_findbypos = Duration(0);
+                for (auto i = iteration_time; i; i--) {
+                    SkipList<int, int> skip_list_map;
+                    measure_insert(skip_list_map, input);
+                    auto const frozen = skip_list_map.freeze();
+                    duration_find += measure_find(frozen);
+                    duration_findbypos += measure_findbypos(frozen);
+                    std::this_thread::sleep_for(SLEEP_TIME);
+                }
+                print_time(INVALID_DURATION, duration_find, duration_findbypos, INVALID_DURATION, iteration_time);
+                cout << endl;
+            }
+
+            {
+                cout << "Frozen AvlOrderStatisticTree:" << endl;
+                Duration duration_find = Duration(0), duration_findbypos = Duration(0);
+                for (auto i = iteration_time; i; i--) {
+                    AvlOrderStatisticTree<int, int> avl_tree;
+                    measure_insert(avl_tree, input);
+                    auto const frozen = avl_tree.freeze();
+                    duration_find += measure_find(frozen);
+                    duration_findbypos += measure_findbypos(frozen);
+                    std::this_thread::sleep_for(SLEEP_TIME);
+                }
+                print_time(INVALID_DURATION, duration_find, duration_findbypos, INVALID_DURATION, iteration_time);
+                cout << endl;
+            }
+
+            {
+                cout << "ConcurrentSkipList:" << endl;
+                unsigned const thread_counts[] = {1, 2, 4, 8, 16, 32};
+                Duration duration_insert = Duration(0), duration_find = Duration(0), duration_findbypos = Duration(0),
+                         duration_erase = Duration(0);
+                Duration duration_concurrent_find[std::size(thread_counts)] = {};
+                for (auto i = iteration_time; i; i--) {
+                    ConcurrentSkipList<int, int> concurrent_list;
+                    duration_insert += measure_insert(concurrent_list, input);
+                    duration_find += measure_find(concurrent_list);
+                    // findbypos walks the bottom level, a full sweep would be quadratic
+                    duration_findbypos += measure_sampled_findbypos(concurrent_list, 1000);
+                    for (size_t t = 0; t < std::size(thread_counts); t++) {
+                        duration_concurrent_find[t] += measure_concurrent_find(concurrent_list, thread_counts[t]);
+                    }
+                    duration_erase += measure_erase(concurrent_list);
+                    std::this_thread::sleep_for(SLEEP_TIME);
+                }
+                print_time(duration_insert, duration_find, duration_findbypos, duration_erase, iteration_time);
+                for (size_t t = 0; t < std::size(thread_counts); t++) {
+                    cout << "Lookup by key with " << thread_counts[t] << " threads (wall clock per operation): "
+                         << duration_concurrent_find[t].count() / iteration_time << " ns" << endl;
+                }
+                cout << endl;
+            }
+
+            {
+                // a single shard is one tree behind one lock, the baseline the shards are meant to beat
+                cout << "ShardedPositionalMap (writers):" << endl;
+                unsigned const thread_counts[] = {1, 2, 4, 8, 16};
+                for (size_t shards : {size_t(1), ShardedPositionalMap<int, int>::DEFAULT_SHARDS}) {
+                    for (auto threads : thread_counts) {
+                        Duration duration_insert = Duration(0);
+                        for (auto i = iteration_time; i; i--) {
+                            ShardedPositionalMap<int, int> sharded_map(shards);
+                            duration_insert += measure_concurrent_insert(sharded_map, input, threads);
+                            auto random_pos = random() % size + 1;
+                            assert(sharded_map.findbypos(random_pos)->first == random_pos - 1);
+                        }
+                        cout << "Insertion with " << shards << " shards and " << threads
+                             << " threads (wall clock per operation): " << duration_insert.count() / iteration_time
+                             << " ns" << endl;
+                    }
+                }
+                cout << endl;
+            }
+
+            {
+                cout << "PersistentOrderStatisticTree:" << endl;
+                Duration duration_insert = Duration(0), duration_find = Duration(0), duration_findbypos = Duration(0),
+                         duration_erase = Duration(0);
+                for (auto i = iteration_time; i; i--) {
+                    PersistentOrderStatisticTree<int, int> persistent_tree;
+                    duration_insert += measure_insert(persistent_tree, input);
+                    auto const snapshot = persistent_tree.snapshot();
+                    duration_find += measure_find(snapshot);
+                    duration_findbypos += measure_findbypos(snapshot);
+                    duration_erase += measure_erase(persistent_tree);
+                    assert(snapshot.size() == size);
+                    std::this_thread::sleep_for(SLEEP_TIME);
+                }
+                print_time(duration_insert, duration_find, duration_findbypos, duration_erase, iteration_time);
+                cout << endl;
+            }
+
+            {
+                cout << "BTreeOrderStatistic:" << endl;
+                Duration duration_insert = Duration(0), duration_find = Duration(0), duration_findbypos = Duration(0),
+                         duration_erase = Duration(0);
+                for (auto i = iteration_time; i; i--) {
+                    BTreeOrderStatistic<int, int> btree;
+                    duration_insert += measure_insert(btree, input);
+                    auto random_key = random() % size;
+                    assert(btree[random_key] == random_key);
+                    duration_find += measure_find(btree);
+                    duration_findbypos += measure_findbypos(btree);
+                    duration_erase += measure_erase(btree);
+                    std::this_thread::sleep_for(SLEEP_TIME);
+                }
+                print_time(duration_insert, duration_find, duration_findbypos, duration_erase, iteration_time);
+                cout << endl;
+            }
+
+            {
+                cout << "DeterministicSkipList:" << endl;
+                Duration duration_insert = Duration(0), duration_find = Duration(0), duration_findbypos = Duration(0),
+                         duration_erase = Duration(0);
+                for (auto i = iteration_time; i; i--) {
+                    DeterministicSkipList<int, int> skip_list;
+                    duration_insert += measure_insert(skip_list, input);
+                    auto random_key = random() % size;
+                    assert(skip_list[random_key] == random_key);
+                    duration_find += measure_find(skip_list);
+                    duration_findbypos += measure_findbypos(skip_list);
+                    duration_erase += measure_erase(skip_list);
+                    std::this_thread::sleep_for(SLEEP_TIME);
+                }
+                print_time(duration_insert, duration_find, duration_findbypos, duration_erase, iteration_time);
+                cout << endl;
+            }
+
+            {
+                cout << "CompactAvlOrderStatisticTree:" << endl;
+                Duration duration_insert = Duration(0), duration_find = Duration(0), duration_findbypos = Duration(0),
+                         duration_erase = Duration(0);
+                for (auto i = iteration_time; i; i--) {
+                    CompactAvlOrderStatisticTree<int, int> tree;
+                    duration_insert += measure_insert(tree, input);
+                    auto random_key = random() % size;
+                    assert(tree[random_key] == random_key);
+                    duration_find += measure_find(tree);
+                    duration_findbypos += measure_findbypos(tree);
+                    duration_erase += measure_erase(tree);
+                    std::this_thread::sleep_for(SLEEP_TIME);
+                }
+                print_time(duration_insert, duration_find, duration_findbypos, duration_erase, iteration_time);
                 cout << endl;
             }
+
+            {
+                cout << "AvlOrderStatisticTree with WeightBalance:" << endl;
+                using Alloc = allocator<pair<const int, int>>;
+                using Tree  = AvlOrderStatisticTree<int, int, less<int>, Alloc, size_t, WeightBalance>;
+                Duration duration_insert = Duration(0), duration_find = Duration(0), duration_findbypos = Duration(0),
+                         duration_erase = Duration(0);
+                for (auto i = iteration_time; i; i--) {
+                    Tree tree;
+                    duration_insert += measure_insert(tree, input);
+                    auto random_key = random() % size;
+                    assert(tree[random_key] == random_key);
+                    duration_find += measure_find(tree);
+                    duration_findbypos += measure_findbypos(tree);
+                    duration_erase += measure_erase(tree);
+                    std::this_thread::sleep_for(SLEEP_TIME);
+                }
+                print_time(duration_insert, duration_find, duration_findbypos, duration_erase, iteration_time);
+                cout << endl;
+            }
+
+            {
+                cout << "AvlOrderStatisticTree with RedBlackBalance:" << endl;
+                using Alloc = allocator<pair<const int, int>>;
+                using Tree  = AvlOrderStatisticTree<int, int, less<int>, Alloc, size_t, RedBlackBalance>;
+                Duration duration_insert = Duration(0), duration_find = Duration(0), duration_findbypos = Duration(0),
+                         duration_erase = Duration(0);
+                for (auto i = iteration_time; i; i--) {
+                    Tree tree;
+                    duration_insert += measure_insert(tree, input);
+                    auto random_key = random() % size;
+                    assert(tree[random_key] == random_key);
+                    duration_find += measure_find(tree);
+                    duration_findbypos += measure_findbypos(tree);
+                    duration_erase += measure_erase(tree);
+                    std::this_thread::sleep_for(SLEEP_TIME);
+                }
+                print_time(duration_insert, duration_find, duration_findbypos, duration_erase, iteration_time);
+                cout << endl;
+            }
+        }
+    }
+
+    // maps far larger than the last level cache, where every hop of a lookup waits on memory
+    std::pair<unsigned, unsigned> constexpr large_config[] = {
+        {1e6, 3},
+        {1e7, 1},
+    };
+
+    for (auto const &[size, iteration_time] : large_config) {
+        cout << "[SIZE: " << size << "]" << endl;
+
+        init_input(size);
+
+        for (double promotion : {0.5, 0.25}) {
+            cout << "SkipList with promotion probability " << promotion << ":" << endl;
+            Duration duration_insert = Duration(0), duration_find = Duration(0), duration_findbypos = Duration(0);
+            for (auto i = iteration_time; i; i--) {
+                SkipList<int, int> skip_list;
+                skip_list.set_promotion_probability(promotion);
+                duration_insert += measure_insert(skip_list, random_input);
+                duration_find += measure_find(skip_list);
+                duration_findbypos += measure_findbypos(skip_list);
+            }
+            print_time(duration_insert, duration_find, duration_findbypos, INVALID_DURATION, iteration_time);
+            cout << endl;
+        }
+
+        {
+            cout << "SkipList batch lookups:" << endl;
+            BatchDurations batch{};
+            for (auto i = iteration_time; i; i--) {
+                SkipList<int, int> skip_list;
+                measure_insert(skip_list, random_input);
+                auto const durations = measure_batch(skip_list, random_input);
+                batch.find += durations.find;
+                batch.find_batch += durations.find_batch;
+                batch.findbypos += durations.findbypos;
+                batch.findbypos_batch += durations.findbypos_batch;
+            }
+            print_batch_time(batch, iteration_time);
+            cout << endl;
+        }
+
+        {
+            cout << "AvlOrderStatisticTree batch lookups:" << endl;
+            BatchDurations batch{};
+            for (auto i = iteration_time; i; i--) {
+                AvlOrderStatisticTree<int, int> avl_tree;
+                measure_insert(avl_tree, random_input);
+                auto const durations = measure_batch(avl_tree, random_input);
+                batch.find += durations.find;
+                batch.find_batch += durations.find_batch;
+                batch.findbypos += durations.findbypos;
+                batch.findbypos_batch += durations.findbypos_batch;
+            }
+            print_batch_time(batch, iteration_time);
+            cout << endl;
+        }
+
+        // one sample per operation, the tail shows how unlucky tower heights compare with gaps bounded by 2 and 4
+        {
+            cout << "SkipList latency:" << endl;
+            SkipList<int, int> skip_list;
+            print_latency(measure_latency(skip_list, random_input));
+            cout << endl;
+        }
+
+        {
+            cout << "DeterministicSkipList latency:" << endl;
+            DeterministicSkipList<int, int> skip_list;
+            print_latency(measure_latency(skip_list, random_input));
+            cout << endl;
         }
     }
 
@@ -1,12 +1,28 @@
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <thread>
 #include <vector>
 
+#include "SkipList.h"
+#include "arena.h"
 #include "avl_order_statistic_tree.h"
+#include "btree_order_statistic.h"
+#include "compact_avl_order_statistic_tree.h"
+#include "concurrent_skip_list.h"
+#include "deterministic_skip_list.h"
+#include "frozen_order_statistic.h"
+#include "persistent_order_statistic_tree.h"
+#include "sharded_positional_map.h"
+#include "thread_pool.h"
 
-template <typename K, typename V>
-inline void print_tree_in_key_order(AvlOrderStatisticTree<K, V> &tree) {
+template <typename K, typename V, typename C>
+inline void print_tree_in_key_order(AvlOrderStatisticTree<K, V, C> &tree) {
     using namespace std;
     cout << "key order: {";
     for (auto itor = tree.begin(); itor != tree.end(); ++itor) {
@@ -15,6 +31,53 @@ inline void print_tree_in_key_order(AvlOrderStatisticTree<K, V> &tree) {
     cout << "}" << endl;
 }
 
+/**
+ * @brief Run `check` on an empty map of each of `Maps`, the engines that must all pass the same checks
+ */
+template <typename... Maps>
+struct Engines {
+    template <typename F>
+    static void run(F const &check) {
+        (check(Maps()), ...);
+    }
+};
+
+using IntAlloc = std::allocator<std::pair<const int, int>>;
+using WideList = SkipList<int, int, std::less<int>, IntAlloc, int64_t>;
+
+template <typename V>
+using PositionalEngines = Engines<SkipList<int, V>, AvlOrderStatisticTree<int, V>>;
+using SizeTypeEngines   = Engines<SkipList<int, int>, WideList, SkipList<int, int, std::less<int>, IntAlloc, uint32_t>,
+                                  AvlOrderStatisticTree<int, int>,
+                                  AvlOrderStatisticTree<int, int, std::less<int>, IntAlloc, uint32_t>>;
+using CompactEngines    = Engines<CompactAvlOrderStatisticTree<int, int>,
+                                  CompactAvlOrderStatisticTree<int, int, std::less<int>, IntAlloc, true>>;
+using BalanceEngines    = Engines<AvlOrderStatisticTree<int, int>,
+                                  AvlOrderStatisticTree<int, int, std::less<int>, IntAlloc, size_t, WeightBalance>,
+                                  AvlOrderStatisticTree<int, int, std::less<int>, IntAlloc, uint32_t, RedBlackBalance>>;
+
+/**
+ * @brief 0 to `count` - 1 scattered, a permutation as long as `count` is not a multiple of 7919
+ */
+inline std::vector<int> scrambled_keys(int count) {
+    std::vector<int> keys;
+    for (int i = 0; i < count; i++) {
+        keys.push_back(i * 7919 % count);
+    }
+    return keys;
+}
+
+/**
+ * @brief `count` pairs (`step` * i, i) in key order, the input of `build_from_sorted`
+ */
+inline std::vector<std::pair<int, int>> sorted_pairs(int count, int step = 1) {
+    std::vector<std::pair<int, int>> pairs;
+    for (int i = 0; i < count; i++) {
+        pairs.emplace_back(step * i, i);
+    }
+    return pairs;
+}
+
 int main() {
     using namespace std;
     vector<int> input  = {3, 5, 2, 9, 8, 7, 1, 4, 6};
@@ -65,11 +128,75 @@ int main() {
             copied_tree.print_tree();
         }
 
+        for (int key = 0; key <= int(n) + 1; key++) {
+            size_t const rank = lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+            assert(tree.rank(key) == rank - (key > target_val_erase));
+            assert(tree.lower_bound(key) == tree.findbypos(tree.rank(key) + 1));
+            assert(tree.upper_bound(key) == tree.findbypos(tree.rank(key + 1) + 1));
+            for (int hi = 0; hi <= int(n) + 1; hi++) {
+                auto const count = count_if(sorted.begin(), sorted.end(), [&](int val) {
+                    return key <= val && val < hi && val != target_val_erase;
+                });
+                assert(tree.count_range(key, hi) == size_t(count));
+            }
+        }
+
+        {
+            AvlOrderStatisticTree<int, int> cloned_tree(tree);
+            cloned_tree.insert(target_val_erase, target_val_erase);
+            cloned_tree.erase(sorted.front());
+            assert(tree.size() == input.size() - 1);
+            assert(tree.find(sorted.front()) != tree.end());
+            assert(tree.find(target_val_erase) == tree.end());
+            for (size_t pos = 1; pos < n; pos++) {
+                assert(cloned_tree.findbypos(pos)->second == sorted[pos]);
+            }
+        }
+
+        {
+            vector<pair<int, int>> pairs;
+            for (auto val : sorted) {
+                pairs.emplace_back(val, val);
+            }
+            AvlOrderStatisticTree<int, int> built_tree;
+            built_tree.build_from_sorted(pairs.begin(), pairs.end());
+            assert(built_tree.size() == n);
+            for (size_t pos = built_tree.BASE_INDEX; pos < n + built_tree.BASE_INDEX; pos++) {
+                assert(built_tree.findbypos(pos)->second == sorted[pos - built_tree.BASE_INDEX]);
+            }
+
+            pairs.emplace_back(sorted.front(), -1);
+            reverse(pairs.begin(), pairs.end());
+            AvlOrderStatisticTree<int, int> assigned_tree(pairs.begin(), pairs.end());
+            assert(assigned_tree.size() == n);
+            assert(assigned_tree.begin()->second == sorted.front());
+            assigned_tree.insert(0, 0);
+            assigned_tree.erase(sorted.back());
+            assert(assigned_tree.last()->second == sorted[n - 2]);
+        }
+
+        {
+            AvlOrderStatisticTree<int, int> batch_tree;
+            vector<pair<int, int>> batch;
+            for (auto val : input) {
+                batch.emplace_back(val, val);
+            }
+            batch_tree.insert_batch(batch.begin(), batch.begin() + 2);
+            batch_tree.insert_batch(batch.begin(), batch.end());
+            assert(batch_tree.size() == n);
+            for (size_t pos = batch_tree.BASE_INDEX; pos < n + batch_tree.BASE_INDEX; pos++) {
+                assert(batch_tree.findbypos(pos)->second == sorted[pos - batch_tree.BASE_INDEX]);
+            }
+            assert(batch_tree.erase_batch(sorted.begin() + 1, sorted.end()) == n - 1);
+            assert(batch_tree.size() == 1 && batch_tree.begin()->first == sorted.front());
+        }
+
         cout << "[*] forward tests passed" << endl;
     }
 
     {
-        auto backward_tree = AvlOrderStatisticTree<int, int>(AvlOrderStatisticTree<int, int>::greater);
+        using DirectionalTree = DirectionalAvlOrderStatisticTree<int, int>;
+        auto backward_tree    = DirectionalTree(DirectionalTree::greater);
         for (auto val : input) {
             backward_tree.insert(val, val);
         }
@@ -79,9 +206,921 @@ int main() {
 
         print_tree_in_key_order(backward_tree);
         backward_tree.print_tree();
+
+        // a function pointer type still takes any function, `directional_less` only the two directions
+        using PointerTree = AvlOrderStatisticTree<int, int, bool (*)(int, int)>;
+        assert(PointerTree(PointerTree::greater).key_comp()(2, 1));
+        bool rejected = false;
+        try {
+            DirectionalTree tree([](int a, int b) { return a % 10 < b % 10; });
+        } catch (std::invalid_argument const &) {
+            rejected = true;
+        }
+        assert(rejected);
+
+        AvlOrderStatisticTree<int, int, std::greater<int>> greater_tree;
+        DirectionalSkipList<int, int> backward_list(false);
+        for (auto val : input) {
+            greater_tree.insert(val, val);
+            backward_list.insert(val, val);
+        }
+        auto const frozen_list = backward_list.freeze();
+        for (size_t pos = 1; pos <= n; pos++) {
+            assert(greater_tree.findbypos(pos)->second == sorted[n - pos]);
+            assert(backward_list.findbypos(pos)->second == sorted[n - pos]);
+            assert(frozen_list.findbypos(pos)->second == sorted[n - pos]);
+            assert(frozen_list.find(sorted[n - pos]) == frozen_list.findbypos(pos));
+        }
+        static_assert(std::is_same_v<SkipList<int, int>::key_compare, std::less<int>>);
+        static_assert(std::is_same_v<AvlOrderStatisticTree<int, int>::key_compare, std::less<int>>);
+        static_assert(std::is_same_v<AvlOrderStatisticTree<int, int>::balance_type, ptrdiff_t>);
+        static_assert(!std::is_constructible_v<SkipList<int, int>, bool>);
         cout << "[*] backward tests passed" << endl;
     }
 
+    {
+        SkipList<int, int> skip_list;
+        for (auto val : input) {
+            skip_list.insert(val, val);
+        }
+
+        assert(skip_list.size() == int(n));
+        assert(skip_list.begin()->second == sorted.front());
+        assert(skip_list.last()->second == sorted.back());
+
+        for (auto const &val : input) {
+            assert(skip_list.find(val)->second == val);
+            assert(skip_list[val] == val);
+        }
+        for (size_t pos = 1; pos <= n; pos++) {
+            assert(skip_list.findbypos(pos)->second == sorted[pos - 1]);
+        }
+
+        skip_list.erase(target_val_erase);
+        assert(skip_list.size() == int(n) - 1);
+        assert(skip_list.find(target_val_erase) == skip_list.end());
+
+        for (int key = 0; key <= int(n) + 1; key++) {
+            int const rank = lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+            assert(skip_list.rank(key) == rank - (key > target_val_erase));
+            assert(skip_list.lower_bound(key) == skip_list.findbypos(skip_list.rank(key) + 1));
+            assert(skip_list.upper_bound(key) == skip_list.findbypos(skip_list.rank(key + 1) + 1));
+            for (int hi = 0; hi <= int(n) + 1; hi++) {
+                auto const count = count_if(sorted.begin(), sorted.end(), [&](int val) {
+                    return key <= val && val < hi && val != target_val_erase;
+                });
+                assert(skip_list.count_range(key, hi) == count);
+            }
+        }
+
+        {
+            SkipList<int, int> cloned_list(skip_list);
+            SkipList<int, int> assigned_list;
+            assigned_list.insert(n, n);
+            assigned_list = skip_list;
+            for (size_t pos = 1; pos < n; pos++) {
+                assert(cloned_list.findbypos(pos)->first == skip_list.findbypos(pos)->first);
+                assert(assigned_list.findbypos(pos)->first == skip_list.findbypos(pos)->first);
+            }
+            assert(cloned_list.last()->first == skip_list.last()->first);
+            cloned_list.insert(target_val_erase, target_val_erase);
+            cloned_list.erase(sorted.back());
+            assert(skip_list.find(target_val_erase) == skip_list.end());
+            assert(skip_list.last()->first == sorted.back());
+            for (size_t pos = 1; pos < n; pos++) {
+                assert(cloned_list.findbypos(pos)->second == sorted[pos - 1]);
+            }
+        }
+
+        for (bool deterministic : {true, false}) {
+            SkipList<int, int> built_list;
+            built_list.build_from_sorted(skip_list.begin(), skip_list.end(), deterministic);
+            assert(built_list.size() == skip_list.size());
+            assert(built_list.last()->second == sorted.back());
+            for (size_t pos = 1; pos < n; pos++) {
+                assert(built_list.findbypos(pos)->second == skip_list.findbypos(pos)->second);
+            }
+            built_list.insert(target_val_erase, target_val_erase);
+            for (size_t pos = 1; pos <= n; pos++) {
+                assert(built_list.findbypos(pos)->second == sorted[pos - 1]);
+            }
+        }
+
+        {
+            vector<pair<int, int>> batch;
+            for (auto val : input) {
+                batch.emplace_back(val + n, val);
+            }
+            skip_list.insert_batch(batch.begin(), batch.end());
+            assert(skip_list.size() == 2 * int(n) - 1);
+            assert(skip_list.findbypos(n)->first == int(n) + sorted.front());
+            assert(skip_list.erase_batch(input.begin(), input.end()) == int(n) - 1);
+            assert(skip_list.findbypos(1)->first == int(n) + sorted.front());
+            assert(skip_list.last()->first == int(n) + sorted.back());
+        }
+
+        {
+            SkipList<int, int> ordered_list;
+            for (int key = 0; key < 100; key++) {
+                auto const [itor, inserted] = ordered_list.insert_or_assign(key, key);
+                assert(inserted && itor->first == key && ordered_list.last() == itor);
+            }
+            for (int key = 99; key >= 0; key -= 3) {
+                ordered_list.erase(key);
+            }
+            assert(ordered_list.size() == 66);
+            for (int pos = 1; pos <= 66; pos++) {
+                assert(ordered_list.findbypos(pos)->first == pos + (pos - 1) / 2);
+            }
+            auto from = ordered_list.begin();
+            for (int key = 1; key < 99; key += 3) {
+                from = ordered_list.find_from(from, key);
+                assert(from->first == key);
+            }
+            assert(ordered_list.find_from(from, 99) == ordered_list.end());
+        }
+
+        {
+            SkipList<int, int> sparse_list;
+            sparse_list.set_promotion_probability(0.3);
+            assert(sparse_list.promotion_probability() == 0.25);
+            for (auto val : input) {
+                sparse_list.insert(val, val);
+            }
+            SkipList<int, int> perfect_list(sparse_list), parallel_list(sparse_list);
+            perfect_list.build_from_sorted(sparse_list.begin(), sparse_list.end());
+            ThreadPool pool(1);
+            auto const pairs = sparse_list.to_vector(pool);
+            parallel_list.build_from_sorted(pairs.begin(), pairs.end(), pool);
+            for (int pos = 1; pos <= int(n); pos++) {
+                assert(sparse_list.findbypos(pos)->second == sorted[pos - 1]);
+                assert(perfect_list.findbypos(pos)->second == sorted[pos - 1]);
+                assert(parallel_list.rank(sorted[pos - 1]) == pos - 1);
+            }
+
+            bool rejected = false;
+            try {
+                sparse_list.set_promotion_probability(0);
+            } catch (std::invalid_argument const &) {
+                rejected = true;
+            }
+            assert(rejected && sparse_list.promotion_probability() == 0.25);
+        }
+
+        {
+            // random heights drawn during a bulk build are capped for the final size, not for an empty list
+            vector<pair<int, int>> const pairs = sorted_pairs(100000);
+            SkipList<int, int> random_list;
+            random_list.build_from_sorted(pairs.begin(), pairs.end(), false);
+            int levels = 0;
+            for (auto itor = random_list.begin(); itor != random_list.end(); ++itor) {
+                levels = max(levels, itor->level);
+            }
+            assert(levels > 3 && random_list.size() == 100000);
+            assert(random_list.findbypos(54321)->first == 54320 && random_list.rank(777) == 777);
+        }
+
+        cout << "[*] skip list tests passed" << endl;
+    }
+
+    {
+        // tiny nodes so that a few hundred keys exercise splits, borrows and merges at every level
+        BTreeOrderStatistic<int, int, std::less<int>, std::allocator<std::pair<const int, int>>, 4, 4> btree;
+        int const count = 500;
+        for (int key = 0; key < count; key++) {
+            btree.insert((key * 37) % count, key);
+        }
+        assert(btree.size() == count);
+        for (int key = 0; key < count; key++) {
+            assert(btree.find(key)->first == key);
+            assert(btree.findbypos(key + 1)->first == key);
+        }
+        assert(btree.findbypos(0) == btree.end() && btree.findbypos(count + 1) == btree.end());
+
+        for (int key = 0; key < count; key += 2) {
+            assert(btree.erase(key) == 1);
+        }
+        assert(btree.erase(0) == 0);
+        assert(btree.size() == count / 2);
+        int expected = 1;
+        for (auto itor = btree.begin(); itor != btree.end(); ++itor, expected += 2) {
+            assert(itor->first == expected);
+        }
+        assert(btree.last()->first == count - 1);
+        for (int pos = 1; pos <= count / 2; pos++) {
+            assert(btree.findbypos(pos)->first == 2 * pos - 1);
+        }
+
+        btree[count] = 7;
+        assert(btree.last()->second == 7);
+        for (int key = count; key >= 0; key--) {
+            btree.erase(key);
+        }
+        assert(btree.size() == 0 && btree.begin() == btree.end());
+
+        BTreeOrderStatistic<int, int> wide;
+        for (auto val : input) {
+            wide.insert(val, val);
+        }
+        wide.erase(target_val_erase);
+        vector<int> remaining = sorted;
+        remaining.erase(find(remaining.begin(), remaining.end(), target_val_erase));
+        for (size_t pos = 1; pos < n; pos++) {
+            assert(wide.findbypos(pos)->second == remaining[pos - 1]);
+        }
+
+        cout << "[*] b+ tree tests passed" << endl;
+    }
+
+    {
+        // every size up to a few full Eytzinger levels, probing the keys and the gaps around them
+        for (int count = 0; count < 40; count++) {
+            AvlOrderStatisticTree<int, int> tree;
+            SkipList<int, int> skip_list;
+            for (int key = 0; key < count; key++) {
+                tree.insert(2 * key, key);
+                skip_list.insert(2 * key, key);
+            }
+            auto const frozen_tree = tree.freeze();
+            auto const frozen_list = skip_list.freeze();
+            assert(frozen_tree.size() == size_t(count) && frozen_list.size() == size_t(count));
+            for (int key = -1; key <= 2 * count; key++) {
+                bool const present = key >= 0 && key % 2 == 0 && key < 2 * count;
+                assert((frozen_tree.find(key) != frozen_tree.end()) == present);
+                assert((frozen_list.find(key) != frozen_list.end()) == present);
+                if (present) {
+                    assert(frozen_tree.find(key)->second == key / 2);
+                    assert(frozen_list.find(key)->second == key / 2);
+                    assert(frozen_tree.findbypos(key / 2 + 1)->first == key);
+                }
+            }
+            assert(frozen_tree.findbypos(0) == frozen_tree.end());
+            assert(frozen_tree.findbypos(count + 1) == frozen_tree.end());
+
+            int key = 0;
+            for (auto itor = frozen_list.begin(); itor != frozen_list.end(); ++itor, key += 2) {
+                // `*itor` yields a pointer to the pair, as the engines' iterators do
+                assert(itor->first == key && (*itor)->second == key / 2);
+                assert(frozen_list.findbypos(key / 2 + 1) == itor && frozen_list.find(key) == itor);
+            }
+            assert(count == 0 || frozen_list.last()->first == 2 * count - 2);
+
+            tree.insert(-1, -1);  // the snapshot does not follow the tree
+            assert(frozen_tree.find(-1) == frozen_tree.end());
+        }
+
+        cout << "[*] frozen tests passed" << endl;
+    }
+
+    {
+        ConcurrentSkipList<int, int> concurrent_list;
+        int const writers = 4, per_writer = 2000;
+        vector<thread> threads;
+        for (int w = 0; w < writers; w++) {
+            // interleaved keys so that writers keep meeting on the same predecessors
+            threads.emplace_back([&concurrent_list, w] {
+                for (int i = 0; i < per_writer; i++) {
+                    assert(concurrent_list.insert(i * writers + w, w));
+                }
+                for (int i = 0; i < per_writer; i += 2) {
+                    assert(concurrent_list.erase(i * writers + w));
+                }
+            });
+        }
+        threads.emplace_back([&concurrent_list] {
+            for (int round = 0; round < 20; round++) {
+                int previous = -1;
+                for (auto itor = concurrent_list.begin(); itor != concurrent_list.end(); ++itor) {
+                    assert(itor->first > previous);
+                    previous = itor->first;
+                }
+                for (int key = 0; key < writers * per_writer; key += 97) {
+                    if (auto itor = concurrent_list.find(key); itor != concurrent_list.end()) {
+                        assert(itor->second == key % writers);
+                    }
+                }
+            }
+        });
+        for (auto &t : threads) {
+            t.join();
+        }
+
+        assert(concurrent_list.size() == writers * per_writer / 2);
+        assert(!concurrent_list.insert(writers, 0) && concurrent_list.find(writers)->second == 0);
+        assert(!concurrent_list.erase(0) && !concurrent_list.contains(0));
+        for (size_t pos = 1; pos <= concurrent_list.size(); pos += 101) {
+            // every odd multiple of `writers` survived, shifted by the writer's index
+            size_t const key = ((pos - 1) / writers * 2 + 1) * writers + (pos - 1) % writers;
+            assert(concurrent_list.findbypos(pos)->first == int(key));
+        }
+        assert(concurrent_list.last()->first == writers * per_writer - 1);
+
+        cout << "[*] concurrent skip list tests passed" << endl;
+    }
+
+    {
+        // enough keys for several redistributions, inserted in order to skew the last shard every time
+        int const count = 20000, writers = 4;
+        ShardedPositionalMap<int, int> sharded(8);
+        ShardedPositionalMap<int, int, SkipList<int, int>> sharded_list(8);
+        ShardedPositionalMap<int, int, BTreeOrderStatistic<int, int>> sharded_btree(8);
+        for (int key = 0; key < count; key++) {
+            sharded.insert(key, key);
+            sharded_list.insert(key, key);
+            sharded_btree.insert(key, key);
+        }
+        for (int pos = 1; pos <= count; pos += 7) {
+            assert(sharded.findbypos(pos)->first == pos - 1);
+            assert(sharded_list.findbypos(pos)->first == pos - 1);
+            assert(sharded_btree.findbypos(pos)->first == pos - 1);
+        }
+        assert(!sharded.findbypos(0) && !sharded.findbypos(count + 1));
+
+        vector<thread> threads;
+        for (int w = 0; w < writers; w++) {
+            threads.emplace_back([&sharded, w] {
+                for (int key = w; key < count; key += writers) {
+                    if (key % 2 == 0) {
+                        assert(sharded.erase(key));
+                    } else {
+                        sharded.insert(count + key, key);
+                    }
+                }
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        assert(sharded.size() == count);
+        assert(!sharded.erase(0) && !sharded.contains(0) && *sharded.find(1) == 1);
+        for (int pos = 1; pos <= count / 2; pos++) {
+            assert(sharded.findbypos(pos)->first == 2 * pos - 1);
+            assert(sharded.findbypos(count / 2 + pos)->first == count + 2 * pos - 1);
+        }
+
+        cout << "[*] sharded map tests passed" << endl;
+    }
+
+    {
+        PersistentOrderStatisticTree<int, int> persistent;
+        for (auto val : input) {
+            persistent.insert(val, val);
+        }
+        auto const before = persistent.snapshot();
+        auto const copy   = persistent;
+        assert(persistent.erase(target_val_erase) == 1 && persistent.erase(target_val_erase) == 0);
+        persistent.insert(0, 0);
+        persistent.insert(sorted.front(), -1);
+
+        assert(before.size() == n && persistent.size() == n);
+        for (size_t pos = 1; pos <= n; pos++) {
+            assert(before.findbypos(pos)->first == sorted[pos - 1]);
+            assert(copy.findbypos(pos)->first == sorted[pos - 1]);
+        }
+        assert(before.find(target_val_erase)->second == target_val_erase && before.find(0) == before.end());
+        assert(persistent.find(target_val_erase) == persistent.end() && persistent.find(sorted.front())->second == -1);
+
+        int expected = sorted.back();
+        for (auto itor = before.last(); itor != before.end(); --itor, expected--) {
+            assert(itor->first == expected);
+        }
+        auto itor = persistent.find(target_val_erase - 1);
+        assert((++itor)->first == target_val_erase + 1 && (--itor)->first == target_val_erase - 1);
+        assert(--persistent.end() == persistent.last());
+
+        // readers take snapshots while the writer goes on, each one must be a complete version
+        PersistentOrderStatisticTree<int, int> shared;
+        thread writer([&shared] {
+            for (int key = 0; key < 3000; key++) {
+                shared.insert(key, key);
+                if (key % 3 == 0) {
+                    shared.erase(key / 3);
+                }
+            }
+        });
+        thread reader([&shared] {
+            for (int round = 0; round < 200; round++) {
+                auto const version = shared.snapshot();
+                size_t count       = 0;
+                int previous       = -1;
+                for (auto itor = version.begin(); itor != version.end(); ++itor, count++) {
+                    assert(itor->first > previous);
+                    previous = itor->first;
+                }
+                assert(count == version.size());
+            }
+        });
+        writer.join();
+        reader.join();
+        assert(shared.size() == 2000 && shared.findbypos(1)->first == 1000);
+
+        cout << "[*] persistent tree tests passed" << endl;
+    }
+
+    {
+        Arena arena;
+        for (int round = 0; round < 3; round++) {
+            using Alloc = std::pmr::polymorphic_allocator<std::pair<const int, int>>;
+            SkipList<int, int, std::less<int>, Alloc> skip_list(&arena);
+            AvlOrderStatisticTree<int, int, std::less<int>, Alloc> tree(&arena);
+            for (auto val : input) {
+                skip_list.insert(val, val);
+                tree.insert(val, val);
+            }
+            skip_list.erase(target_val_erase);
+            tree.erase(target_val_erase);
+            for (size_t pos = 1; pos < n; pos++) {
+                assert(skip_list.findbypos(pos)->second == tree.findbypos(pos)->second);
+            }
+        }
+        arena.release();
+
+        cout << "[*] arena tests passed" << endl;
+    }
+
+    {
+        // move-only values without a default constructor, which neither container may copy nor build from nothing
+        struct Boxed {
+            explicit Boxed(int v) : value(make_unique<int>(v)) {}
+            unique_ptr<int> value;
+        };
+        int const count = n;
+        PositionalEngines<Boxed>::run([&](auto map) {
+            using size_type = typename decltype(map)::size_type;
+            for (auto val : input) {
+                assert(map.try_emplace(val, val).second);
+            }
+            assert(!map.try_emplace(sorted.front(), -1).second);
+            assert(*map.find(sorted.front())->second.value == sorted.front());
+
+            Boxed boxed(-1);
+            assert(!map.insert_or_assign(sorted.front(), std::move(boxed)).second);
+            assert(!boxed.value && *map.find(sorted.front())->second.value == -1);
+            assert(map.emplace(count + 1, count + 1).second);
+            assert(!map.emplace(count + 1, 0).second);
+            assert(*map.findbypos(count + 1)->second.value == count + 1);
+
+            auto moved = std::move(map);
+            assert(moved.size() == size_type(count + 1) && map.size() == 0);
+            map = std::move(moved);
+            assert(map.size() == size_type(count + 1) && moved.size() == 0);
+            assert(*map.findbypos(count)->second.value == sorted.back());
+        });
+
+        SkipList<int, unique_ptr<int>> skip_list;
+        AvlOrderStatisticTree<int, unique_ptr<int>> tree;
+        for (auto val : input) {
+            skip_list[val] = make_unique<int>(val);
+            tree[val]      = make_unique<int>(val);
+        }
+        for (int pos = 1; pos <= count; pos++) {
+            assert(*skip_list.findbypos(pos)->second == sorted[pos - 1]);
+            assert(*tree.findbypos(pos)->second == sorted[pos - 1]);
+        }
+
+        cout << "[*] move tests passed" << endl;
+    }
+
+    {
+        int const count = 40;
+        PositionalEngines<int>::run([&](auto map) {
+            using size_type = typename decltype(map)::size_type;
+            for (int key = 0; key < count; key++) {
+                map.insert(key, key);
+            }
+            for (int first = 0; first <= count + 1; first++) {
+                for (int last = max(first - 1, 0); last <= count + 2; last++) {
+                    auto trimmed = map;
+                    vector<int> expected;
+                    for (int key = 0; key < count; key++) {
+                        if (key + 1 < first || key + 1 >= last) {
+                            expected.push_back(key);
+                        }
+                    }
+                    assert(trimmed.erase_positions(first, last) == size_type(count - expected.size()));
+                    assert(trimmed.size() == size_type(expected.size()));
+                    for (size_t pos = 1; pos <= expected.size(); pos++) {
+                        assert(trimmed.findbypos(pos)->first == expected[pos - 1]);
+                        assert(trimmed.find(expected[pos - 1]) == trimmed.findbypos(pos));
+                    }
+                    assert(expected.empty() ? trimmed.last() == trimmed.end()
+                                            : trimmed.last()->first == expected.back());
+                    trimmed.insert(first, first);
+                    auto const rank = lower_bound(expected.begin(), expected.end(), first) - expected.begin();
+                    assert(trimmed.rank(first) == size_type(rank));
+                }
+            }
+            assert(!map.erase_at(0) && !map.erase_at(count + 1));
+            for (int pos = count; pos > 0; pos -= 2) {
+                assert(map.erase_at(pos));
+            }
+            for (int pos = 1; pos <= count / 2; pos++) {
+                assert(map.findbypos(pos)->first == 2 * (pos - 1));
+            }
+        });
+
+        cout << "[*] positional erase tests passed" << endl;
+    }
+
+    {
+        ThreadPool pool(3);
+        int const count = 3 * AvlOrderStatisticTree<int, int>::PARALLEL_GRAIN;
+        vector<int> evens, threes;
+        AvlOrderStatisticTree<int, int> even_tree, three_tree;
+        for (int key = 0; key < count; key++) {
+            if (key % 2 == 0) {
+                evens.push_back(key);
+                even_tree.insert(key, 0);
+            }
+            if (key % 3 == 0) {
+                threes.push_back(key);
+                three_tree.insert(key, 1);
+            }
+        }
+        auto const check = [](AvlOrderStatisticTree<int, int> &tree, vector<int> const &expected) {
+            assert(tree.size() == expected.size());
+            size_t pos = 0;
+            for (auto itor = tree.begin(); itor != tree.end(); ++itor) {
+                assert(itor->first == expected[pos++]);
+            }
+            for (pos = 0; pos < expected.size(); pos += 97) {
+                assert(tree.findbypos(pos + 1)->first == expected[pos]);
+                assert(tree.rank(expected[pos]) == pos);
+            }
+        };
+
+        vector<int> united, expected;
+        set_union(evens.begin(), evens.end(), threes.begin(), threes.end(), back_inserter(united));
+        auto merged = even_tree;
+        merged.union_with(AvlOrderStatisticTree<int, int>(three_tree), pool);
+        check(merged, united);
+        assert(merged.find(6)->second == 1 && merged.find(4)->second == 0);
+
+        set_intersection(evens.begin(), evens.end(), threes.begin(), threes.end(), back_inserter(expected));
+        auto common = even_tree;
+        common.intersect_with(AvlOrderStatisticTree<int, int>(three_tree), pool);
+        check(common, expected);
+
+        expected.clear();
+        set_difference(evens.begin(), evens.end(), threes.begin(), threes.end(), back_inserter(expected));
+        auto remaining = even_tree;
+        remaining.difference_with(std::move(three_tree));
+        check(remaining, expected);
+        check(even_tree, evens);
+
+        auto upper = merged.split(count / 2 + 1);
+        assert(merged.size() + upper.size() == united.size());
+        assert(merged.last()->first <= count / 2 && upper.begin()->first > count / 2);
+        auto tail = upper.split_at(11);
+        assert(upper.size() == 10);
+        upper.join(std::move(tail));
+        merged.join(std::move(upper));
+        check(merged, united);
+
+        cout << "[*] set operation tests passed" << endl;
+    }
+
+    {
+        ThreadPool pool(3);
+        int const count = 3 * SkipList<int, int>::PARALLEL_GRAIN + 7;
+        auto const pairs = sorted_pairs(count, 2);
+        vector<int> keys, positions;
+        for (int i = 0; i < count; i++) {
+            keys.push_back(i);
+            positions.push_back(i);
+        }
+        PositionalEngines<int>::run([&](auto map) {
+            map.build_from_sorted(pairs.begin(), pairs.end(), pool);
+            assert(map.size() == count);
+            assert(map.to_vector(pool) == pairs);
+
+            auto found = map.find_many(keys, pool);
+            for (int i = 0; i < count; i++) {
+                assert(i % 2 ? found[i] == map.end() : found[i]->second == i / 2);
+            }
+            auto by_pos = map.findbypos_many({positions.begin(), positions.end()}, pool);
+            for (int i = 1; i < count; i++) {
+                assert(by_pos[i]->first == 2 * (i - 1));
+            }
+
+            map.insert(1, -1);
+            map.erase(2 * (count - 1));
+            assert(map.findbypos(2)->second == -1 && map.last()->first == 2 * (count - 2));
+            assert(map.rank(2 * count / 3) == count / 3 + 1);
+        });
+
+        // exporting builds every pair from its node, neither keys nor values need a default constructor
+        struct Label {
+            explicit Label(int v) : value(v) {}
+            bool operator<(Label const &other) const { return value < other.value; }
+            int value;
+        };
+        Engines<SkipList<Label, Label>, AvlOrderStatisticTree<Label, Label>>::run([&](auto map) {
+            for (int i = count; i > 0; i--) {
+                map.try_emplace(Label(i), i);
+            }
+            auto const exported = map.to_vector(pool);
+            assert(exported.size() == count);
+            for (int i = 0; i < count; i++) {
+                assert(exported[i].first.value == i + 1 && exported[i].second.value == i + 1);
+            }
+        });
+
+        cout << "[*] bulk tests passed" << endl;
+    }
+
+    {
+        int const count = 1000;
+        vector<int> keys, positions;
+        for (int i = -3; i < 2 * count + 3; i++) {
+            keys.push_back(i * 7919 % (2 * count + 5));
+            positions.push_back(i % (count + 3));
+        }
+        // every batch result must be what the lookup of the same key or position returns
+        auto const check = [&](auto &map, auto const &positions) {
+            auto found = map.find_batch(keys);
+            for (size_t i = 0; i < keys.size(); i++) {
+                assert(found[i] == map.find(keys[i]));
+            }
+            auto by_pos = map.findbypos_batch(positions);
+            for (size_t i = 0; i < positions.size(); i++) {
+                assert(by_pos[i] == map.findbypos(positions[i]));
+            }
+        };
+
+        SkipList<int, int> skip_list;
+        AvlOrderStatisticTree<int, int> avl_tree;
+        vector<size_t> avl_positions(positions.begin() + 3, positions.end());
+        check(skip_list, positions);
+        check(avl_tree, avl_positions);
+        for (int i = 0; i < count; i++) {
+            int const key = i * 7919 % count * 2;
+            skip_list.insert(key, i);
+            avl_tree.insert(key, i);
+            if (i == 0 || i == count - 1) {
+                check(skip_list, positions);
+                check(avl_tree, avl_positions);
+            }
+        }
+        assert(skip_list.find_batch(keys).size() == keys.size() && avl_tree.findbypos_batch({}).empty());
+
+        cout << "[*] batch lookup tests passed" << endl;
+    }
+
+    {
+        // keys in a scrambled order, then every other one erased, so gaps split, borrow and merge at every level
+        DeterministicSkipList<int, int> list;
+        int const count = 2000;
+        for (int i = 0; i < count; i++) {
+            int const key = i * 7919 % count;
+            assert(list.try_emplace(key, key).second);
+        }
+        assert(!list.try_emplace(0, -1).second && list.find(0)->second == 0);
+        assert(list.size() == count);
+        for (int key = 0; key < count; key++) {
+            assert(list.find(key)->first == key);
+            assert(list.findbypos(key + 1)->first == key);
+            assert(list.rank(key) == key);
+        }
+        assert(list.findbypos(count + 1) == list.end() && list.find(count) == list.end());
+        assert(list.lower_bound(-5)->first == 0 && list.upper_bound(count - 1) == list.end());
+        assert(list.count_range(10, 20) == 10);
+
+        for (int i = 0; i < count; i++) {
+            int const key = i * 7919 % count;
+            if (key % 2 == 0) {
+                assert(list.erase(key));
+            }
+        }
+        assert(!list.erase(0) && list.size() == count / 2);
+        int expected = 1;
+        for (auto itor = list.begin(); itor != list.end(); ++itor, expected += 2) {
+            assert(itor->first == expected && itor->second == expected);
+        }
+        assert(list.last()->first == count - 1);
+        for (int pos = 1; pos <= count / 2; pos++) {
+            assert(list.findbypos(pos)->first == 2 * pos - 1);
+        }
+        assert(list.upper_bound(4)->first == 5 && list.rank(4) == 2);
+
+        // erasing at a position and from both ends keeps positions and the last element right
+        assert(list.erase_at(1) && list.begin()->first == 3);
+        assert(list.erase_at(list.size()) && list.last()->first == count - 3);
+        assert(!list.erase_at(0) && !list.erase_at(list.size() + 1));
+        list[count] = 7;
+        assert(list.last()->second == 7 && list.findbypos(list.size())->first == count);
+
+        DeterministicSkipList<int, int> copy(list);
+        DeterministicSkipList<int, int> moved(std::move(list));
+        assert(list.size() == 0 && list.begin() == list.end());
+        assert(copy.size() == moved.size());
+        for (int pos = 1; pos <= copy.size(); pos++) {
+            assert(copy.findbypos(pos)->first == moved.findbypos(pos)->first);
+        }
+        while (moved.size() > 0) {
+            assert(moved.erase_at(moved.size() / 2 + 1));
+        }
+        assert(moved.begin() == moved.end() && moved.find(1) == moved.end());
+
+        DeterministicSkipList<int, int> from_input;
+        for (auto val : input) {
+            from_input.insert(val, val);
+        }
+        from_input.erase(target_val_erase);
+        vector<int> remaining = sorted;
+        remaining.erase(find(remaining.begin(), remaining.end(), target_val_erase));
+        for (size_t pos = 1; pos < n; pos++) {
+            assert(from_input.findbypos(pos)->second == remaining[pos - 1]);
+        }
+        assert(from_input.freeze().size() == n - 1);
+
+        // unsigned positions: the largest one is simply out of range
+        DeterministicSkipList<int, int, std::less<int>, std::allocator<std::pair<const int, int>>, uint32_t> narrow;
+        for (int i = 0; i < count; i++) {
+            narrow.insert(i * 7919 % count, i);
+        }
+        assert(narrow.size() == uint32_t(count) && narrow.rank(count / 2) == uint32_t(count / 2));
+        assert(narrow.findbypos(uint32_t(count))->first == count - 1 && narrow.count_range(10, 20) == 10);
+        assert(!narrow.erase_at(numeric_limits<uint32_t>::max()) && narrow.erase_at(1) && narrow.begin()->first == 1);
+
+        cout << "[*] deterministic skip list tests passed" << endl;
+    }
+
+    {
+        // narrow and wide size types must answer exactly what the default ones do
+        int const count = 3000;
+        auto const keys = scrambled_keys(count);
+        SizeTypeEngines::run([&](auto map) {
+            using size_type = typename decltype(map)::size_type;
+            for (int i = 0; i < count; i++) {
+                map.insert(keys[i], i);
+            }
+            assert(map.size() == count);
+            for (int key = 0; key < count; key += 7) {
+                assert(map.rank(key) == size_type(key));
+                assert(map.findbypos(key + 1)->first == key);
+            }
+            assert(map.count_range(100, 200) == 100);
+            assert(map.erase_positions(1, 101) == 100 && map.begin()->first == 100);
+            assert(map.erase_at(map.size()) && map.last()->first == count - 2);
+            vector<int> doomed{100, 101, 5000};
+            assert(map.erase_batch(doomed.begin(), doomed.end()) == 2);
+            assert(map.size() == count - 103 && map.findbypos(1)->first == 102);
+
+            // the largest position must not overflow on its way to the bound checks
+            auto const largest = numeric_limits<typename decltype(map)::size_type>::max();
+            assert(!map.erase_at(largest) && map.erase_positions(map.size(), largest) == 1);
+            assert(map.size() == count - 104 && map.last()->first == count - 3);
+        });
+        static_assert(SkipList<int, int>::HEAD_LEVEL == 32 && WideList::HEAD_LEVEL == 64);
+
+        WideList wide;
+        auto const pairs = sorted_pairs(10000);
+        ThreadPool pool(2);
+        wide.build_from_sorted(pairs.begin(), pairs.end(), pool);
+        assert(wide.findbypos(int64_t(5000))->first == 4999 && wide.rank(10000) == 10000);
+
+        cout << "[*] size type tests passed" << endl;
+    }
+
+    {
+        // both iterator flavors walk the same tree, and erasing compacts the pool under them
+        int const count = 2000;
+        auto const keys = scrambled_keys(count);
+        CompactEngines::run([&](auto tree) {
+            using size_type = typename decltype(tree)::size_type;
+            tree.reserve(count);
+            for (int key : keys) {
+                assert(tree.try_emplace(key, key).second);
+            }
+            assert(!tree.try_emplace(0, -1).second && tree.find(0)->second == 0);
+            for (int key = 0; key < count; key++) {
+                auto itor = tree.find(key);
+                assert(itor->first == key && tree.findbypos(key + 1)->first == key && tree.rank(key) == size_type(key));
+                ++itor;
+                assert(key + 1 == count ? itor == tree.end() : itor->first == key + 1);
+            }
+            assert(tree.findbypos(count + 1) == tree.end() && tree.find(count) == tree.end());
+            // inserted iterators come from the insertion's own descent, rotations included
+            for (int key = 0; key + 2 < count; key += 3) {
+                assert(tree.erase(key));
+                auto itor = tree.try_emplace(key, key).first;
+                assert(itor->first == key && (++itor)->first == key + 1);
+                itor = tree.insert_or_assign(key + 1, key + 1).first;
+                assert(itor->first == key + 1 && (++itor)->first == key + 2);
+            }
+            assert(tree.lower_bound(-5)->first == 0 && tree.upper_bound(count - 1) == tree.end());
+            assert(tree.count_range(10, 20) == 10);
+
+            for (int key : keys) {
+                if (key % 2 == 0) {
+                    assert(tree.erase(key));
+                }
+            }
+            assert(!tree.erase(0) && tree.size() == count / 2);
+            int expected = 1;
+            for (auto itor = tree.begin(); itor != tree.end(); ++itor, expected += 2) {
+                assert(itor->first == expected && itor->second == expected);
+            }
+            assert(tree.last()->first == count - 1);
+            auto itor = tree.upper_bound(4);
+            assert(itor->first == 5 && (++itor)->first == 7 && tree.rank(4) == 2);
+
+            assert(tree.erase_at(1) && tree.begin()->first == 3);
+            assert(tree.erase_at(tree.size()) && tree.last()->first == count - 3);
+            assert(!tree.erase_at(0) && !tree.erase_at(tree.size() + 1));
+            tree[count] = 7;
+            assert(tree.last()->second == 7 && tree.findbypos(tree.size())->first == count);
+
+            auto copy  = tree;
+            auto moved = std::move(tree);
+            assert(copy.size() == moved.size());
+            for (unsigned pos = 1; pos <= copy.size(); pos++) {
+                assert(copy.findbypos(pos)->first == moved.findbypos(pos)->first);
+            }
+            while (moved.size() > 0) {
+                assert(moved.erase_at(moved.size() / 2 + 1));
+            }
+            assert(moved.begin() == moved.end() && moved.find(1) == moved.end());
+
+            auto const pairs = sorted_pairs(1000, 2);
+            copy.build_from_sorted(pairs.begin(), pairs.end());
+            assert(copy.size() == 1000 && copy.findbypos(500)->second == 499 && copy.rank(999) == 500);
+            assert(copy.freeze().size() == 1000);
+
+            decltype(copy) from_input;
+            for (auto val : input) {
+                from_input.insert(val, val);
+            }
+            from_input.erase(target_val_erase);
+            vector<int> remaining = sorted;
+            remaining.erase(find(remaining.begin(), remaining.end(), target_val_erase));
+            for (size_t pos = 1; pos < n; pos++) {
+                assert(from_input.findbypos(pos)->second == remaining[pos - 1]);
+            }
+        });
+
+        cout << "[*] compact tree tests passed" << endl;
+    }
+
+    {
+        // every balancing policy must answer exactly what the default one does, whatever reshapes the tree, and keep
+        // its own invariant after every step
+        int const count = 3000;
+        auto const keys = scrambled_keys(count);
+        BalanceEngines::run([&](auto tree) {
+            using size_type = typename decltype(tree)::size_type;
+            for (int i = 0; i < count; i++) {
+                tree.insert(i, i);  // ascending, the worst case for rotations
+                assert(tree.check_invariants());
+            }
+            for (int i = 0; i < count; i += 2) {
+                tree.erase(keys[i]);
+                assert(tree.check_invariants());
+            }
+            assert(tree.size() == count / 2 && tree.begin()->first == 1);
+            for (int pos = 1; pos <= count / 2; pos += 7) {
+                assert(tree.findbypos(pos)->first == 2 * pos - 1 && tree.rank(2 * pos - 1) == size_type(pos - 1));
+            }
+
+            auto rest = tree.split(count / 3);
+            assert(tree.check_invariants() && rest.check_invariants());
+            assert(tree.size() == count / 6 && rest.begin()->first == count / 3 + 1);
+            tree.join(std::move(rest));
+            assert(tree.check_invariants());
+            decltype(tree) evens;
+            for (int i = 0; i < count; i += 2) {
+                evens.insert(i, i);
+            }
+            tree.union_with(decltype(tree)(evens));
+            assert(tree.check_invariants() && tree.size() == count && tree.findbypos(count)->first == count - 1);
+            tree.difference_with(std::move(evens));
+            assert(tree.check_invariants() && tree.size() == count / 2);
+            assert(tree.erase_positions(1, 11) == 10 && tree.begin()->first == 21 && tree.check_invariants());
+            for (int pos = tree.size(); pos > 0; pos -= 5) {
+                assert(tree.erase_at(pos) && tree.check_invariants());
+            }
+            auto const batch = sorted_pairs(count / 4, 3);
+            tree.insert_batch(batch.begin(), batch.end());
+            assert(tree.check_invariants());
+            tree.erase_batch(keys.begin(), keys.begin() + count / 2);
+            assert(tree.check_invariants());
+
+            auto const pairs = sorted_pairs(1000);
+            tree.build_from_sorted(pairs.begin(), pairs.end());
+            assert(tree.check_invariants());
+            tree.erase(500);
+            tree.insert(1000, 1000);
+            decltype(tree) copy(tree);
+            assert(copy.check_invariants());
+            for (int pos = 1; pos <= 1000; pos++) {
+                assert(copy.findbypos(pos)->first == pos - (pos <= 500));
+            }
+        });
+
+        cout << "[*] balance policy tests passed" << endl;
+    }
+
     cout << "[*] all tests passed" << endl;
     return 0;
 }